@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Generate src/digits.h, the seven segment digits and state icons for
+the controller OLED.
+
+Bitmaps are written in SSD1306 page order: one byte per column per
+8 pixel page, LSB on top, pages one after the other. That is the layout
+of Oled.c's framebuffer, so each page of a glyph is a single memcpy.
+
+    python3 scripts/gen_digits.py > src/digits.h
+"""
+
+BIG_W, BIG_H = 24, 32
+SMALL_W, SMALL_H = 12, 16
+ICON_W, ICON_H = 32, 32
+BATT_W, BATT_H, BATT_BARS = 16, 8, 4
+
+# a b c d e f g
+SEGMENTS = {
+    "0": "abcdef", "1": "bc", "2": "abdeg", "3": "abcdg", "4": "bcfg",
+    "5": "acdfg", "6": "acdefg", "7": "abc", "8": "abcdefg", "9": "abcdfg",
+    "-": "g", " ": "", "P": "abefg",
+}
+
+
+def seven_segment(ch, w, h, t):
+    px = [[0] * w for _ in range(h)]
+
+    def fill(x0, y0, x1, y1):
+        for y in range(y0, y1):
+            for x in range(x0, x1):
+                px[y][x] = 1
+
+    mid = h // 2
+    rects = {
+        "a": (t, 0, w - t, t),
+        "b": (w - t, t, w, mid - t // 2),
+        "c": (w - t, mid + (t + 1) // 2, w, h - t),
+        "d": (t, h - t, w - t, h),
+        "e": (0, mid + (t + 1) // 2, t, h - t),
+        "f": (0, t, t, mid - t // 2),
+        "g": (t, mid - t // 2, w - t, mid + (t + 1) // 2),
+    }
+    for seg in SEGMENTS[ch]:
+        fill(*rects[seg])
+    return px
+
+
+def icon_run():
+    px = [[0] * ICON_W for _ in range(ICON_H)]
+    for y in range(4, 28):
+        half = min(y - 4, 27 - y)
+        for x in range(6, 6 + 2 * half + 1):
+            px[y][x] = 1
+    return px
+
+
+def icon_stop():
+    px = [[0] * ICON_W for _ in range(ICON_H)]
+    for y in range(4, 28):
+        for x in list(range(7, 13)) + list(range(19, 25)):
+            px[y][x] = 1
+    return px
+
+
+def icon_expired():
+    px = [[0] * ICON_W for _ in range(ICON_H)]
+    for i in range(4, 28):
+        for d in range(-2, 3):
+            if 4 <= i + d < 28:
+                px[i][i + d] = 1
+                px[i][31 - (i + d)] = 1
+    return px
+
+
+def icon_battery(bars):
+    px = [[0] * BATT_W for _ in range(BATT_H)]
+    for x in range(0, 14):
+        px[0][x] = px[BATT_H - 1][x] = 1
+    for y in range(BATT_H):
+        px[y][0] = px[y][13] = 1
+    for y in range(2, 6):
+        px[y][14] = px[y][15] = 1
+        for bar in range(bars):
+            px[y][2 + 3 * bar] = px[y][3 + 3 * bar] = 1
+    return px
+
+
+def pages(px):
+    h, w = len(px), len(px[0])
+    out = []
+    for page in range(h // 8):
+        for x in range(w):
+            byte = 0
+            for bit in range(8):
+                byte |= px[page * 8 + bit][x] << bit
+            out.append(byte)
+    return out
+
+
+def emit(name, glyphs, w, h):
+    size = w * h // 8
+    print(f"static const uint8_t {name}[][{size}] = {{")
+    for label, px in glyphs:
+        data = pages(px)
+        print(f"\t/* {label} */")
+        print("\t{")
+        for i in range(0, len(data), 16):
+            print("\t\t" + ", ".join(f"0x{b:02x}" for b in data[i:i + 16]) + ",")
+        print("\t},")
+    print("};")
+    print()
+
+
+print("/* Generated by scripts/gen_digits.py, do not edit */")
+print()
+print("#define DIGIT_BIG_W %d" % BIG_W)
+print("#define DIGIT_BIG_PAGES %d" % (BIG_H // 8))
+print("#define DIGIT_SMALL_W %d" % SMALL_W)
+print("#define DIGIT_SMALL_PAGES %d" % (SMALL_H // 8))
+print("#define ICON_W %d" % ICON_W)
+print("#define ICON_PAGES %d" % (ICON_H // 8))
+print("#define BATT_W %d" % BATT_W)
+print("#define BATT_PAGES %d" % (BATT_H // 8))
+print("#define BATT_BARS %d" % BATT_BARS)
+print()
+print("/* Index 10 is a dash, 11 is blank */")
+print("#define DIGIT_DASH 10")
+print("#define DIGIT_BLANK 11")
+print("/* Small glyphs only, pairing */")
+print("#define DIGIT_P 12")
+print()
+
+big = "0123456789- "
+small = "0123456789- P"
+emit("digit_big", [(c if c != " " else "blank", seven_segment(c, BIG_W, BIG_H, 4)) for c in big],
+     BIG_W, BIG_H)
+emit("digit_small", [(c if c != " " else "blank", seven_segment(c, SMALL_W, SMALL_H, 2)) for c in small],
+     SMALL_W, SMALL_H)
+emit("icon_state", [("running", icon_run()), ("stopped", icon_stop()), ("expired", icon_expired())],
+     ICON_W, ICON_H)
+emit("icon_battery", [("%d bars" % n, icon_battery(n)) for n in range(BATT_BARS + 1)], BATT_W, BATT_H)
@@ -0,0 +1,213 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/drivers/adc/voltage_divider.h>
+#include <zephyr/bluetooth/services/bas.h>
+
+#include "Battery.h"
+#include "Radio.h"
+
+LOG_MODULE_DECLARE(Controller_app, LOG_LEVEL_INF);
+
+#define BATTERY_PERIOD_MS 60000
+/* with no connection or advertising there is no droop to avoid */
+#define BATTERY_RADIO_WAIT_MS 500
+/* first order low pass, new = old + (sample - old) / 2^BATTERY_FILTER_SHIFT */
+#define BATTERY_FILTER_SHIFT 2
+
+static const struct voltage_divider_dt_spec vbatt = VOLTAGE_DIVIDER_DT_SPEC_GET(DT_PATH(vbatt));
+
+/*
+
+*/
+/*CHARGE LEVEL*/
+struct battery_point
+{
+	uint16_t mv;
+	uint8_t level;
+};
+
+/* Single cell LiPo at light load, highest voltage first */
+static const struct battery_point discharge_curve[] = {
+	{4200, 100},
+	{4100, 90},
+	{4000, 78},
+	{3900, 62},
+	{3800, 45},
+	{3700, 28},
+	{3600, 12},
+	{3500, 4},
+	{3300, 0},
+};
+
+static uint8_t battery_level_from_mv(uint16_t mv)
+{
+	const struct battery_point *hi = &discharge_curve[0];
+
+	if (mv >= hi->mv)
+	{
+		return hi->level;
+	}
+
+	for (size_t i = 1; i < ARRAY_SIZE(discharge_curve); i++)
+	{
+		const struct battery_point *lo = &discharge_curve[i];
+
+		if (mv >= lo->mv)
+		{
+			return lo->level + (hi->level - lo->level) * (mv - lo->mv) / (hi->mv - lo->mv);
+		}
+		hi = lo;
+	}
+	return 0;
+}
+
+/*
+
+*/
+/*SAMPLING*/
+static battery_cb_t battery_cb;
+static struct battery_stats stats;
+static uint32_t mv_filtered; // mV << BATTERY_FILTER_SHIFT
+static uint8_t level = 100;
+static bool armed;
+
+static void battery_period(struct k_work *work);
+static void battery_radio_quiet(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(battery_work, battery_period);
+K_WORK_DEFINE(battery_radio_work, battery_radio_quiet);
+
+static int battery_sample(int32_t *mv)
+{
+	int16_t raw;
+	struct adc_sequence seq = {
+		.buffer = &raw,
+		.buffer_size = sizeof(raw),
+	};
+
+	// channel, resolution and oversampling come from the devicetree
+	int err = adc_sequence_init_dt(&vbatt.port, &seq);
+	if (err)
+	{
+		return err;
+	}
+
+	uint32_t start = k_cycle_get_32();
+
+	err = adc_read(vbatt.port.dev, &seq);
+	stats.us_last = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	stats.us_max = MAX(stats.us_max, stats.us_last);
+	if (err)
+	{
+		return err;
+	}
+
+	*mv = MAX(raw, 0);
+	err = adc_raw_to_millivolts_dt(&vbatt.port, mv);
+	if (err)
+	{
+		return err;
+	}
+	return voltage_divider_scale_dt(&vbatt, mv);
+}
+
+static void battery_measure(void)
+{
+	int32_t mv;
+
+	k_work_reschedule(&battery_work, K_MSEC(BATTERY_PERIOD_MS));
+
+	int err = battery_sample(&mv);
+	if (err)
+	{
+		LOG_ERR("Battery sample failed (err %d)", err);
+		return;
+	}
+
+	if (0 == stats.samples++)
+	{
+		mv_filtered = mv << BATTERY_FILTER_SHIFT;
+	}
+	else
+	{
+		mv_filtered += mv - (int32_t)(mv_filtered >> BATTERY_FILTER_SHIFT);
+	}
+	stats.mv = mv_filtered >> BATTERY_FILTER_SHIFT;
+
+	uint8_t new_level = battery_level_from_mv(stats.mv);
+
+	LOG_INF("Battery %d mV, filtered %d mV, %d%%, sample %d us", mv, stats.mv, new_level,
+			stats.us_last);
+
+	if (new_level != level)
+	{
+		level = new_level;
+		bt_bas_set_battery_level(level);
+		if (battery_cb)
+		{
+			battery_cb(level);
+		}
+	}
+}
+
+static void battery_radio_quiet(struct k_work *work)
+{
+	if (armed)
+	{
+		armed = false;
+		stats.after_radio++;
+		battery_measure();
+	}
+}
+
+/** @brief Period timer and radio timeout, both on the system workqueue */
+static void battery_period(struct k_work *work)
+{
+	if (armed)
+	{
+		// no radio event within the wait, so nothing to avoid
+		armed = false;
+		stats.on_timeout++;
+		battery_measure();
+		return;
+	}
+
+	armed = true;
+	if (radio_after_event(&battery_radio_work))
+	{
+		LOG_WRN("No radio waiter slot, sampling on the timeout");
+	}
+	k_work_reschedule(&battery_work, K_MSEC(BATTERY_RADIO_WAIT_MS));
+}
+
+int battery_init(battery_cb_t cb)
+{
+	battery_cb = cb;
+
+	if (!adc_is_ready_dt(&vbatt.port))
+	{
+		LOG_ERR("ADC %s is not ready", vbatt.port.dev->name);
+		return -ENODEV;
+	}
+
+	int err = adc_channel_setup_dt(&vbatt.port);
+	if (err)
+	{
+		LOG_ERR("ADC channel setup failed (err %d)", err);
+		return err;
+	}
+
+	k_work_schedule(&battery_work, K_NO_WAIT);
+	return 0;
+}
+
+uint8_t battery_level(void)
+{
+	return level;
+}
+
+void battery_stats_get(struct battery_stats *out)
+{
+	*out = stats;
+}
@@ -0,0 +1,75 @@
+#ifndef DCLK_BATTERY
+#define DCLK_BATTERY
+
+/**
+ * @file Battery.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Battery voltage and state of charge
+ *
+ * Once a minute the SAADC takes one 16x oversampled burst, started right
+ * after a radio event so the regulator droop on TX is not measured. The
+ * voltage is low-pass filtered, turned into a charge level with a LiPo
+ * discharge curve and published through the Battery Service.
+ *
+ * A burst is 16 conversions of 10 us acquisition plus 2 us conversion,
+ * about 200 us of SAADC time per minute. The measured cost per sample,
+ * driver overhead included, is kept in struct battery_stats.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/types.h>
+
+	/** @brief Called when the charge level changes */
+	typedef void (*battery_cb_t)(uint8_t level);
+
+	/** @brief Sampling cost */
+	struct battery_stats
+	{
+		/** samples taken */
+		uint32_t samples;
+		/** samples that waited for a radio event */
+		uint32_t after_radio;
+		/** samples taken on the timeout with the radio idle */
+		uint32_t on_timeout;
+		/** time in adc_read for the last and the worst sample */
+		uint32_t us_last;
+		uint32_t us_max;
+		/** filtered battery voltage */
+		uint16_t mv;
+	};
+
+	/** @brief Set up the SAADC channel and start sampling
+	 *
+	 * @param[in] cb called on the system workqueue when the level changes, may be NULL
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int battery_init(battery_cb_t cb);
+
+	/** @brief Current charge level
+	 *
+	 * @retval 0 to 100 %, 100 until the first sample is taken
+	 */
+	uint8_t battery_level(void);
+
+	/** @brief Copy the sampling statistics
+	 *
+	 * @param[out] stats filled with the current statistics
+	 */
+	void battery_stats_get(struct battery_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_BATTERY */
@@ -0,0 +1,58 @@
+#ifndef DCLK_BOOT
+#define DCLK_BOOT
+
+/**
+ * @file Boot.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Timestamps of the boot phases, from reset to a live clock
+ *
+ * Each phase is recorded the first time it is marked. Times are from
+ * the start of the system timer, which runs a few ms after reset.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/types.h>
+
+	enum boot_phase
+	{
+		BOOT_MAIN,		/**< main() entered */
+		BOOT_BT_READY,	/**< bt_enable finished */
+		BOOT_SETTINGS,	/**< bonds and keys loaded */
+		BOOT_ADV,		/**< first advertising started */
+		BOOT_DISPLAY,	/**< OLED initialized */
+		BOOT_FRAME,		/**< first clock frame on the OLED */
+		BOOT_CONN,		/**< first display connected */
+		BOOT_LIVE,		/**< first clock notification sent */
+		BOOT_PHASE_COUNT,
+	};
+
+	/** @brief Record a boot phase, later calls for the same phase are ignored
+	 *
+	 * Safe to call from any context.
+	 *
+	 * @param[in] phase phase reached
+	 */
+	void boot_mark(enum boot_phase phase);
+
+	/** @brief Time a phase was reached
+	 *
+	 * @param[in] phase phase to look up
+	 *
+	 * @retval time since boot in us, 0 if not reached yet
+	 */
+	uint32_t boot_time_us(enum boot_phase phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_BOOT */
@@ -0,0 +1,169 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+
+#include <soc.h>
+#include <nrfx_pwm.h>
+
+#include "Buzzer.h"
+#include "Radio.h"
+
+LOG_MODULE_DECLARE(Controller_app, LOG_LEVEL_ERR);
+
+#define BUZZER_NODE DT_PATH(zephyr_user)
+#define BUZZER_PIN NRF_DT_GPIOS_TO_PSEL(BUZZER_NODE, buzzer_gpios)
+#define BUZZER_INVERTED (DT_GPIO_FLAGS(BUZZER_NODE, buzzer_gpios) & GPIO_ACTIVE_LOW)
+
+/* 1 MHz PWM clock, so countertop is the tone period in us */
+#define BUZZ_CLOCK_HZ 1000000
+#define BUZZ_TOP_MAX 0x7FFF
+#define BUZZ_REST_TOP 1000
+/* every sequence entry plays for this many periods */
+#define BUZZ_REPEATS 15
+#define BUZZ_SEQ_MAX 128
+/* longest a start waits for a radio event to end, well under a beep */
+#define BUZZ_RADIO_WAIT_MS 4
+
+/* In the sequence values bit 15 selects the polarity, set for active high */
+#define BUZZ_POLARITY (BUZZER_INVERTED ? 0 : 0x8000)
+
+/*
+
+
+*/
+/*PATTERNS*/
+struct buzz_step
+{
+	uint16_t freq_hz; // 0 for a rest
+	uint16_t ms;
+};
+
+static const struct buzz_step pattern_countdown[] = {
+	{2700, 80},
+};
+
+static const struct buzz_step pattern_horn[] = {
+	{880, 400},
+	{0, 50},
+	{880, 400},
+	{0, 50},
+	{880, 600},
+};
+
+static const struct buzz_step pattern_chirp[] = {
+	{2000, 40},
+	{0, 30},
+	{3000, 40},
+};
+
+static const struct
+{
+	const struct buzz_step *steps;
+	uint8_t len;
+} patterns[] = {
+	[BUZZER_COUNTDOWN] = {pattern_countdown, ARRAY_SIZE(pattern_countdown)},
+	[BUZZER_HORN] = {pattern_horn, ARRAY_SIZE(pattern_horn)},
+	[BUZZER_CHIRP] = {pattern_chirp, ARRAY_SIZE(pattern_chirp)},
+};
+
+/*
+
+
+*/
+/*PLAYBACK*/
+static const nrfx_pwm_t buzz_pwm = NRFX_PWM_INSTANCE(0);
+
+/* Read by EasyDMA while playing, only rewritten once the PWM is stopped */
+static nrf_pwm_values_wave_form_t buzz_seq[BUZZ_SEQ_MAX];
+
+int buzzer_init(void)
+{
+	nrfx_pwm_config_t config = NRFX_PWM_DEFAULT_CONFIG(BUZZER_PIN, NRF_PWM_PIN_NOT_CONNECTED,
+													   NRF_PWM_PIN_NOT_CONNECTED,
+													   NRF_PWM_PIN_NOT_CONNECTED);
+
+	config.base_clock = NRF_PWM_CLK_1MHz;
+	config.count_mode = NRF_PWM_MODE_UP;
+	config.load_mode = NRF_PWM_LOAD_WAVE_FORM;
+	config.step_mode = NRF_PWM_STEP_AUTO;
+#if defined(NRFX_PWM_PIN_INVERTED)
+	if (BUZZER_INVERTED)
+	{
+		config.output_pins[0] |= NRFX_PWM_PIN_INVERTED;
+	}
+#else
+	config.pin_inverted[0] = BUZZER_INVERTED;
+#endif
+
+	// no handler, the sequence ends itself and nothing needs the CPU
+	nrfx_err_t err = nrfx_pwm_init(&buzz_pwm, &config, NULL, NULL);
+	if (NRFX_SUCCESS != err)
+	{
+		LOG_ERR("Buzzer PWM init failed (err %d)", err);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static size_t buzz_expand(const struct buzz_step *steps, uint8_t len)
+{
+	size_t n = 0;
+
+	for (uint8_t i = 0; i < len; i++)
+	{
+		uint16_t top = steps[i].freq_hz ? MIN(BUZZ_CLOCK_HZ / steps[i].freq_hz, BUZZ_TOP_MAX)
+										: BUZZ_REST_TOP;
+		uint16_t duty = steps[i].freq_hz ? top / 2 : 0;
+		uint32_t entry_us = (uint32_t)top * (BUZZ_REPEATS + 1);
+		uint32_t count = MAX(1, (steps[i].ms * 1000U + entry_us / 2) / entry_us);
+
+		for (; count && (n < BUZZ_SEQ_MAX); count--, n++)
+		{
+			buzz_seq[n] = (nrf_pwm_values_wave_form_t){
+				.channel_0 = duty | BUZZ_POLARITY,
+				.channel_1 = BUZZ_POLARITY,
+				.channel_2 = BUZZ_POLARITY,
+				.counter_top = top,
+			};
+		}
+	}
+
+	if (n == BUZZ_SEQ_MAX)
+	{
+		LOG_WRN("Buzzer pattern truncated");
+	}
+	return n;
+}
+
+int buzzer_play(enum buzzer_pattern pattern)
+{
+	if (pattern >= ARRAY_SIZE(patterns))
+	{
+		return -EINVAL;
+	}
+
+	// the sequence buffer is in use until the peripheral has stopped
+	nrfx_pwm_stop(&buzz_pwm, true);
+
+	size_t n = buzz_expand(patterns[pattern].steps, patterns[pattern].len);
+	// the start transient should not land on a radio event
+	(void)radio_wait_quiet(RADIO_USER_BUZZER, K_MSEC(BUZZ_RADIO_WAIT_MS));
+
+	nrf_pwm_sequence_t seq = {
+		.values.p_wave_form = buzz_seq,
+		.length = n * (sizeof(nrf_pwm_values_wave_form_t) / sizeof(uint16_t)),
+		.repeats = BUZZ_REPEATS,
+		.end_delay = 0,
+	};
+
+	nrfx_pwm_simple_playback(&buzz_pwm, &seq, 1, NRFX_PWM_FLAG_STOP);
+
+	return 0;
+}
+
+void buzzer_stop(void)
+{
+	nrfx_pwm_stop(&buzz_pwm, false);
+}
@@ -0,0 +1,59 @@
+#ifndef DCLK_BUZZER
+#define DCLK_BUZZER
+
+/**
+ * @file Buzzer.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Buzzer patterns played by the PWM peripheral
+ *
+ * A pattern is expanded into a PWM sequence in RAM once and then played
+ * by EasyDMA to the end. No interrupts or timers run while it plays.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/types.h>
+
+	enum buzzer_pattern
+	{
+		/** short beep for each of the last seconds */
+		BUZZER_COUNTDOWN,
+		/** shot clock violation */
+		BUZZER_HORN,
+		/** pairing mode entered */
+		BUZZER_CHIRP,
+		BUZZER_PATTERN_COUNT,
+	};
+
+	/** @brief Initialize the PWM peripheral for the buzzer
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int buzzer_init(void);
+
+	/** @brief Play a pattern, cutting off whatever is playing
+	 *
+	 * @param[in] pattern pattern to play
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int buzzer_play(enum buzzer_pattern pattern);
+
+	/** @brief Silence the buzzer */
+	void buzzer_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_BUZZER */
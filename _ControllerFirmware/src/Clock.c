@@ -0,0 +1,159 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/toolchain.h>
+
+#include "Clock.h"
+
+LOG_MODULE_REGISTER(Clock, LOG_LEVEL_INF);
+
+/*
+
+
+*/
+/*MODEL*/
+struct clock_model
+{
+	uint32_t deadline; // valid while running
+	uint32_t held;	   // valid while stopped
+	uint16_t epoch;
+	uint8_t state;
+};
+
+static struct clock_model model = {
+	.state = CLOCK_RUNNING,
+};
+
+/* Odd while a write is in progress */
+static atomic_t clock_seq;
+static struct k_spinlock clock_lock;
+
+static inline void clock_write_begin(void)
+{
+	atomic_inc(&clock_seq);
+	compiler_barrier();
+}
+
+static inline void clock_write_end(void)
+{
+	compiler_barrier();
+	atomic_inc(&clock_seq);
+}
+
+static uint32_t clock_left(uint32_t deadline, uint32_t now)
+{
+	int32_t left = (int32_t)(deadline - now);
+
+	return (left > 0) ? left : 0;
+}
+
+/*
+
+
+*/
+/*WRITERS*/
+void clock_start(uint32_t duration)
+{
+	k_spinlock_key_t key = k_spin_lock(&clock_lock);
+
+	clock_write_begin();
+	model.deadline = k_uptime_get_32() + duration;
+	model.state = CLOCK_RUNNING;
+	model.epoch++;
+	clock_write_end();
+
+	k_spin_unlock(&clock_lock, key);
+}
+
+bool clock_stop(void)
+{
+	bool stopped = false;
+	k_spinlock_key_t key = k_spin_lock(&clock_lock);
+
+	if (CLOCK_RUNNING == model.state)
+	{
+		uint32_t held = clock_left(model.deadline, k_uptime_get_32());
+
+		clock_write_begin();
+		model.held = held;
+		model.state = CLOCK_STOPPED;
+		model.epoch++;
+		clock_write_end();
+		stopped = true;
+	}
+
+	k_spin_unlock(&clock_lock, key);
+
+	return stopped;
+}
+
+bool clock_expire(void)
+{
+	bool expired = false;
+	k_spinlock_key_t key = k_spin_lock(&clock_lock);
+
+	if (CLOCK_RUNNING == model.state)
+	{
+		clock_write_begin();
+		model.deadline = k_uptime_get_32();
+		model.state = CLOCK_EXPIRED;
+		model.epoch++;
+		clock_write_end();
+		expired = true;
+	}
+
+	k_spin_unlock(&clock_lock, key);
+
+	return expired;
+}
+
+void clock_restore(uint8_t state, uint32_t remaining, uint16_t epoch)
+{
+	k_spinlock_key_t key = k_spin_lock(&clock_lock);
+
+	clock_write_begin();
+	model.held = remaining;
+	model.deadline = k_uptime_get_32();
+	model.state = (CLOCK_EXPIRED == state) ? CLOCK_EXPIRED : CLOCK_STOPPED;
+	model.epoch = epoch + 1;
+	clock_write_end();
+
+	k_spin_unlock(&clock_lock, key);
+}
+
+/*
+
+
+*/
+/*READER*/
+void clock_snapshot(struct clock_snapshot *snap)
+{
+	struct clock_model copy;
+	atomic_val_t seq;
+
+	do
+	{
+		seq = atomic_get(&clock_seq);
+		compiler_barrier();
+		copy = model;
+		compiler_barrier();
+	} while ((seq & 1) || (seq != atomic_get(&clock_seq)));
+
+	snap->stamp = k_uptime_get_32();
+	snap->state = copy.state;
+	snap->epoch = copy.epoch;
+
+	if (CLOCK_RUNNING == copy.state)
+	{
+		snap->remaining = clock_left(copy.deadline, snap->stamp);
+	}
+	else if (CLOCK_STOPPED == copy.state)
+	{
+		snap->remaining = copy.held;
+	}
+	else
+	{
+		snap->remaining = 0;
+	}
+	snap->deadline = snap->stamp + snap->remaining;
+}
@@ -0,0 +1,85 @@
+#ifndef DCLK_CLOCK
+#define DCLK_CLOCK
+
+/**
+ * @file Clock.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Shot clock model shared by the buttons, the timer ISR and the app
+ *
+ * Writers (start, stop, expire) are serialized by a spinlock and bump a
+ * sequence counter around every update. Readers never block: they copy
+ * the model and retry only if a write overlapped the copy.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+#define CLOCK_RUNNING 0
+#define CLOCK_STOPPED 1
+#define CLOCK_EXPIRED 2
+
+	/** @brief Consistent view of the shot clock
+	 *
+	 * remaining is derived from the deadline at the time of the read, so
+	 * two snapshots taken while running differ only by elapsed time.
+	 */
+	struct clock_snapshot
+	{
+		uint32_t stamp;	   // uptime (ms) the snapshot was taken
+		uint32_t deadline; // uptime (ms) the clock reaches zero
+		uint32_t remaining;
+		uint16_t epoch; // bumped on every start, stop and expiry
+		uint8_t state;
+	};
+
+	/** @brief Start the clock counting down from a full shot
+	 *
+	 * @param[in] duration time on the clock in ms
+	 */
+	void clock_start(uint32_t duration);
+
+	/** @brief Stop the clock and hold the remaining time
+	 *
+	 * @retval true if the clock was running.
+	 */
+	bool clock_stop(void);
+
+	/** @brief Mark the clock as expired. Safe to call from ISR.
+	 *
+	 * @retval true if the clock was running. A timer that fires after
+	 *         clock_stop() is ignored.
+	 */
+	bool clock_expire(void);
+
+	/** @brief Put back a clock saved before System OFF
+	 *
+	 * There is no time base in System OFF, so a clock that was running
+	 * comes back stopped with the time it had left.
+	 *
+	 * @param[in] state saved state
+	 * @param[in] remaining saved remaining time in ms
+	 * @param[in] epoch saved epoch, bumped so displays see a new one
+	 */
+	void clock_restore(uint8_t state, uint32_t remaining, uint16_t epoch);
+
+	/** @brief Read the clock without locking. Safe to call from any context.
+	 *
+	 * @param[out] snap filled with a consistent copy of the clock
+	 */
+	void clock_snapshot(struct clock_snapshot *snap);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_CLOCK */
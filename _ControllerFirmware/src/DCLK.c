@@ -13,16 +13,19 @@
 #include <errno.h>
 
 #include <zephyr/sys/byteorder.h>
-// #include <zephyr/kernel.h>
+#include <zephyr/kernel.h>
 
 #include <zephyr/bluetooth/bluetooth.h>
 // #include <zephyr/bluetooth/hci.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/crypto.h>
 #include <zephyr/settings/settings.h>
 
 #include "DCLK.h"
+#include "Boot.h"
+#include "Trace.h"
 
 #define DLCK_LOG 1
 
@@ -32,10 +35,11 @@
 LOG_MODULE_DECLARE(Controller_app, LOG_LEVEL_INF);
 #endif
 
-static bool notify_state_enabled;
-static bool notify_clock_enabled;
 static uint8_t state;
 static uint32_t clock;
+static struct dclk_sync sync;
+static uint8_t sync_buf[DCLK_SYNC_LEN];
+static uint16_t sync_seq;
 static struct dclk_cb dclk_cb;
 
 static dclk_info dclk_status =
@@ -54,20 +58,190 @@ static unsigned int passkey;
 	BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE, \
 					BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, NULL)
 
-#define BT_LE_ADV_CONN_ACCEPT_LIST                                         \
+#define BT_LE_ADV_CONN_ACCEPT_LIST(_int_min, _int_max)                     \
 	BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_FILTER_CONN, \
-					BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, NULL)
+					_int_min, _int_max, NULL)
 
+/* The UUID is in the advertising data so displays can scan passively,
+ * the name is only there for phones that ask
+ */
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-	BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
-
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_DCLK_VAL),
 };
 
 static const struct bt_data sd[] = {
-	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_DCLK_VAL),
+	BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
+};
+
+/*BROADCAST*/
+/* Optional connectionless mode: the sync record, followed by a truncated
+ * AES CBC-MAC, rides in periodic advertising. The key is random, kept in
+ * settings and only readable by bonded displays over the DCLK service.
+ */
+static struct bt_le_ext_adv *bcast_adv;
+static bool bcast_en;
+static uint8_t bcast_key[16];
+static bool bcast_key_valid;
+static uint8_t bcast_data[DCLK_BCAST_LEN];
+
+static const struct bt_data bcast_ad[] = {
+	BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
 };
 
+static int bcast_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+							  void *cb_arg)
+{
+	if (!strcmp(name, "bkey") && (len == sizeof(bcast_key)))
+	{
+		bcast_key_valid = (read_cb(cb_arg, bcast_key, sizeof(bcast_key)) == sizeof(bcast_key));
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(dclk, "dclk", NULL, bcast_settings_set, NULL, NULL);
+
+/* New key, so displays unpaired by a fresh pairing can no longer follow */
+static void bcast_key_new(void)
+{
+	int err = bt_rand(bcast_key, sizeof(bcast_key));
+	if (err)
+	{
+		LOG_ERR("Broadcast key generation failed (err %d)\n", err);
+		bcast_key_valid = false;
+		return;
+	}
+	bcast_key_valid = true;
+
+	err = settings_save_one("dclk/bkey", bcast_key, sizeof(bcast_key));
+	if (err)
+	{
+		LOG_ERR("Broadcast key save failed (err %d)\n", err);
+	}
+}
+
+static int bcast_mac(const uint8_t *frame, uint8_t *mac)
+{
+	uint8_t block[16];
+	uint8_t enc[16];
+
+	BUILD_ASSERT(DCLK_SYNC_LEN > 16 && DCLK_SYNC_LEN <= 32);
+
+	int err = bt_encrypt_be(bcast_key, frame, enc);
+	if (err)
+	{
+		return err;
+	}
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, &frame[16], DCLK_SYNC_LEN - 16);
+	block[15] = DCLK_SYNC_LEN;
+	for (size_t i = 0; i < sizeof(block); i++)
+	{
+		block[i] ^= enc[i];
+	}
+
+	err = bt_encrypt_be(bcast_key, block, enc);
+	if (err)
+	{
+		return err;
+	}
+
+	memcpy(mac, enc, DCLK_MAC_LEN);
+	return 0;
+}
+
+static void bcast_update(const uint8_t *frame)
+{
+	if (!bcast_en || !bcast_key_valid)
+	{
+		return;
+	}
+
+	sys_put_le16(DCLK_COMPANY_ID, bcast_data);
+	memcpy(&bcast_data[2], frame, DCLK_SYNC_LEN);
+
+	int err = bcast_mac(frame, &bcast_data[2 + DCLK_SYNC_LEN]);
+	if (err)
+	{
+		LOG_ERR("Broadcast MAC failed (err %d)\n", err);
+		return;
+	}
+
+	struct bt_data per_ad = BT_DATA(BT_DATA_MANUFACTURER_DATA, bcast_data, sizeof(bcast_data));
+
+	err = bt_le_per_adv_set_data(bcast_adv, &per_ad, 1);
+	if (err)
+	{
+		LOG_ERR("Periodic data update failed (err %d)\n", err);
+	}
+}
+
+static int bcast_start(void)
+{
+	int err;
+
+	if (!bcast_adv)
+	{
+		err = bt_le_ext_adv_create(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_EXT_ADV,
+												   BT_GAP_ADV_SLOW_INT_MIN,
+												   BT_GAP_ADV_SLOW_INT_MAX, NULL),
+								   NULL, &bcast_adv);
+		if (err)
+		{
+			LOG_ERR("Broadcast set create failed (err %d)\n", err);
+			return err;
+		}
+
+		err = bt_le_ext_adv_set_data(bcast_adv, bcast_ad, ARRAY_SIZE(bcast_ad), NULL, 0);
+		if (err)
+		{
+			return err;
+		}
+
+		err = bt_le_per_adv_set_param(bcast_adv,
+									  BT_LE_PER_ADV_PARAM(DCLK_BCAST_INTERVAL,
+														  DCLK_BCAST_INTERVAL,
+														  BT_LE_PER_ADV_OPT_NONE));
+		if (err)
+		{
+			LOG_ERR("Periodic param failed (err %d)\n", err);
+			return err;
+		}
+	}
+
+	err = bt_le_per_adv_start(bcast_adv);
+	if (err && (err != -EALREADY))
+	{
+		LOG_ERR("Periodic start failed (err %d)\n", err);
+		return err;
+	}
+
+	err = bt_le_ext_adv_start(bcast_adv, BT_LE_EXT_ADV_START_DEFAULT);
+	if (err && (err != -EALREADY))
+	{
+		LOG_ERR("Broadcast start failed (err %d)\n", err);
+		return err;
+	}
+
+	LOG_INF("Broadcast started\n");
+	return 0;
+}
+
+static void bcast_stop(void)
+{
+	if (!bcast_adv)
+	{
+		return;
+	}
+
+	bt_le_per_adv_stop(bcast_adv);
+	bt_le_ext_adv_stop(bcast_adv);
+	LOG_INF("Broadcast stopped\n");
+}
+
 static void setup_accept_list_cb(const struct bt_bond_info *info, void *user_data)
 {
 	int *bond_cnt = user_data;
@@ -109,6 +283,22 @@ static int setup_accept_list(uint8_t local_id)
 	return bond_cnt;
 }
 
+/* Undirected advertising slows down in steps the longer nobody connects */
+static const struct adv_step
+{
+	uint16_t int_min;
+	uint16_t int_max;
+	uint32_t dwell_ms;
+} adv_steps[] = {
+	{BT_GAP_ADV_FAST_INT_MIN_1, BT_GAP_ADV_FAST_INT_MAX_1, 30000},
+	{BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, 60000},
+	{BT_GAP_ADV_SLOW_INT_MIN, BT_GAP_ADV_SLOW_INT_MAX, 0},
+};
+
+static uint8_t adv_step;
+static bool accept_list_dirty = true;
+static int accept_list_cnt;
+
 void pair_DCLK(struct k_work *work)
 {
 	LOG_INF("Pairing Beginning--");
@@ -125,6 +315,8 @@ void pair_DCLK(struct k_work *work)
 	{
 		LOG_INF("Bond deleted succesfully \n");
 	}
+	accept_list_dirty = true;
+	bcast_key_new();
 
 	LOG_INF("Advertising with no Accept list \n");
 	// One shot advertizing due to bt_adv_param settings
@@ -139,12 +331,22 @@ void pair_DCLK(struct k_work *work)
 	}
 }
 
+static void adv_step_next(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(adv_step_work, adv_step_next);
+
 void advertise_DCLK(struct k_work *work)
 {
 	int err = 0;
 	bt_le_adv_stop();
 
-	int allowed_cnt = setup_accept_list(BT_ID_DEFAULT);
+	// only touch the controller's list when the bonds changed
+	if (accept_list_dirty)
+	{
+		accept_list_cnt = setup_accept_list(BT_ID_DEFAULT);
+		accept_list_dirty = (accept_list_cnt < 0);
+	}
+
+	int allowed_cnt = accept_list_cnt;
 	LOG_DBG("bond_count = %d", allowed_cnt);
 	if (allowed_cnt < 0)
 	{
@@ -152,18 +354,25 @@ void advertise_DCLK(struct k_work *work)
 	}
 	else if (allowed_cnt > 0)
 	{
+		const struct adv_step *step = &adv_steps[adv_step];
+
 		LOG_INF("Acceptlist setup number  = %d \n", allowed_cnt);
-		// One shot advertizing due to bt_adv_param settings
-		// stops upon connection
-		err = bt_le_adv_start(BT_LE_ADV_CONN_ACCEPT_LIST, ad, ARRAY_SIZE(ad), sd,
-							  ARRAY_SIZE(sd));
+		// Resumes by itself after each connection until stopped
+		err = bt_le_adv_start(BT_LE_ADV_CONN_ACCEPT_LIST(step->int_min, step->int_max),
+							  ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
 
 		if (err)
 		{
 			LOG_INF("Advertising failed to start (err %d)\n", err);
 			return;
 		}
-		LOG_INF("Advertising successfully started\n");
+		LOG_INF("Advertising successfully started, step %d\n", adv_step);
+		boot_mark(BOOT_ADV);
+
+		if (step->dwell_ms)
+		{
+			k_work_reschedule(&adv_step_work, K_MSEC(step->dwell_ms));
+		}
 		return;
 	}
 
@@ -174,27 +383,185 @@ void advertise_DCLK(struct k_work *work)
 K_WORK_DEFINE(advertise_DCLK_work, advertise_DCLK);
 K_WORK_DEFINE(pair_DCLK_work, pair_DCLK);
 
+static void adv_step_next(struct k_work *work)
+{
+	if (adv_step < (ARRAY_SIZE(adv_steps) - 1))
+	{
+		adv_step++;
+		k_work_submit(&advertise_DCLK_work);
+	}
+}
+
+static void adv_step_reset(void)
+{
+	adv_step = 0;
+	k_work_cancel_delayable(&adv_step_work);
+}
+
+/* High duty directed advertising to the display that just dropped. It
+ * lasts 1.28 s, after which on_connected reports a timeout and the
+ * accept list advertising takes over.
+ */
+static bt_addr_le_t reconnect_peer;
+static uint32_t reconnect_time;
+static bt_addr_le_t last_peer;
+static bool last_peer_valid;
+
+/* Set once bt_enable has finished and the settings are loaded */
+static bool dclk_ready;
+static bool reconnect_pending;
+
+static int dclk_reconnect_start(void);
+
+void reconnect_DCLK(struct k_work *work)
+{
+	struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(
+		BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_ONE_TIME |
+			(IS_ENABLED(CONFIG_BT_PRIVACY) ? BT_LE_ADV_OPT_DIR_ADDR_RPA : 0),
+		0, 0, &reconnect_peer);
+
+	bt_le_adv_stop();
+
+	int err = bt_le_adv_start(&param, NULL, 0, NULL, 0);
+	if (err)
+	{
+		LOG_INF("Directed advertising failed (err %d)\n", err);
+		k_work_submit(&advertise_DCLK_work);
+		return;
+	}
+	LOG_INF("Directed advertising to last peer\n");
+	boot_mark(BOOT_ADV);
+}
+
+K_WORK_DEFINE(reconnect_DCLK_work, reconnect_DCLK);
+
+/*CONNECTION PARAMETERS*/
+/* 7.5 - 15 ms while the clock runs so events reach the displays quickly.
+ * Every link takes up to one event length per interval, so with more
+ * displays the interval grows to fit them all plus one for advertising.
+ */
+#define DCLK_CONN_INT_ACTIVE_MIN 6
+#define DCLK_CONN_TIMEOUT_ACTIVE 400
+#define DCLK_CONN_EVENT_UNITS DIV_ROUND_UP(CONFIG_BT_CTLR_SDC_MAX_CONN_EVENT_LEN_DEFAULT, 1250)
+/* 100 - 125 ms and 4 skipped events while idle to save radio time */
+#define DCLK_CONN_PARAM_IDLE BT_LE_CONN_PARAM_INIT(80, 100, 4, 600)
+
+static bool conn_active;
+
+static void dclk_count_conn(struct bt_conn *conn, void *user_data)
+{
+	struct bt_conn_info info;
+	uint8_t *count = user_data;
+
+	if (!bt_conn_get_info(conn, &info) && (BT_CONN_STATE_CONNECTED == info.state))
+	{
+		(*count)++;
+	}
+}
+
+static void conn_param_apply(struct bt_conn *conn, void *user_data)
+{
+	const struct bt_le_conn_param *param = user_data;
+	struct bt_conn_info info;
+
+	if (bt_conn_get_info(conn, &info) || (BT_CONN_STATE_CONNECTED != info.state))
+	{
+		return;
+	}
+
+	if ((info.le.interval >= param->interval_min) &&
+		(info.le.interval <= param->interval_max) &&
+		(info.le.latency == param->latency))
+	{
+		return;
+	}
+
+	int err = bt_conn_le_param_update(conn, param);
+	if (err)
+	{
+		LOG_INF("Conn param update failed (err %d)\n", err);
+	}
+}
+
+static void conn_param_update(struct k_work *work)
+{
+	struct bt_le_conn_param param = DCLK_CONN_PARAM_IDLE;
+
+	if (conn_active)
+	{
+		uint8_t links = 0;
+
+		bt_conn_foreach(BT_CONN_TYPE_LE, dclk_count_conn, &links);
+
+		uint16_t int_min = MAX(DCLK_CONN_INT_ACTIVE_MIN, (links + 1) * DCLK_CONN_EVENT_UNITS);
+
+		param = (struct bt_le_conn_param)BT_LE_CONN_PARAM_INIT(int_min, 2 * int_min, 0,
+																DCLK_CONN_TIMEOUT_ACTIVE);
+	}
+
+	bt_conn_foreach(BT_CONN_TYPE_LE, conn_param_apply, &param);
+}
+
+K_WORK_DEFINE(conn_param_work, conn_param_update);
+
+static void dclk_status_changed(void)
+{
+	if (dclk_cb.status_cb)
+	{
+		dclk_cb.status_cb();
+	}
+}
+
 /*CONNECTION*/
 
 static void on_connected(struct bt_conn *conn, uint8_t err)
 {
+	trace_event(TRACE_CONN, err);
 	if (err)
 	{
 		LOG_INF("Connection failed (err %u)\n", err);
+		reconnect_time = 0;
+		adv_step_reset();
 		k_work_submit(&advertise_DCLK_work);
 		return;
 	}
 
 	LOG_INF("Connected\n");
-	dclk_status.num_conn++;
+	boot_mark(BOOT_CONN);
+	bt_addr_le_copy(&last_peer, bt_conn_get_dst(conn));
+	last_peer_valid = true;
+	if (reconnect_time)
+	{
+		LOG_INF("Reconnected after %d ms\n", k_uptime_get_32() - reconnect_time);
+		reconnect_time = 0;
+		// directed advertising is one shot, bring back the other displays' advertising
+		k_work_submit(&advertise_DCLK_work);
+	}
+	dclk_status_changed();
+	k_work_submit(&conn_param_work);
 	// bt_conn_set_security(conn, BT_SECURITY_L4);
 }
 
 static void on_disconnected(struct bt_conn *conn, uint8_t reason)
 {
 	LOG_INF("Disconnected (reason %u)\n", reason);
-	dclk_status.num_conn--;
-	// advertize to try and reconnect
+	trace_event(TRACE_DISCONN, reason);
+	dclk_status_changed();
+	// the remaining links may fit a shorter interval
+	k_work_submit(&conn_param_work);
+	adv_step_reset();
+
+	// advertize to try and reconnect, directed first if it was a bonded display.
+	// While broadcasting a display leaves on purpose to follow the train.
+	const bt_addr_le_t *peer = bt_conn_get_dst(conn);
+
+	if (!dclk_status.pair_en && !bcast_en && bt_addr_le_is_bonded(BT_ID_DEFAULT, peer))
+	{
+		bt_addr_le_copy(&reconnect_peer, peer);
+		reconnect_time = k_uptime_get_32();
+		k_work_submit(&reconnect_DCLK_work);
+		return;
+	}
 	k_work_submit(&advertise_DCLK_work);
 }
 
@@ -214,10 +581,19 @@ static void on_security_changed(struct bt_conn *conn, bt_security_t level, enum
 	}
 }
 
+static void on_le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency,
+								uint16_t timeout)
+{
+	dclk_status.conn_interval = interval;
+	LOG_INF("Conn params: interval %d us, latency %d, timeout %d ms\n",
+			interval * 1250, latency, timeout * 10);
+}
+
 struct bt_conn_cb connection_callbacks = {
 	.connected = on_connected,
 	.disconnected = on_disconnected,
 	.security_changed = on_security_changed,
+	.le_param_updated = on_le_param_updated,
 };
 /*
 
@@ -225,16 +601,91 @@ struct bt_conn_cb connection_callbacks = {
 
 */
 /*NOTIFICATION AND STATE*/
-/* state configuration change callback function */
-static void dclk_ccc_state_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
+/* sync configuration write callback function, called once per peer */
+static ssize_t dclk_ccc_sync_cfg_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+									   uint16_t value)
+{
+	// push a fresh record to the new subscriber
+	if (value == BT_GATT_CCC_NOTIFY)
+	{
+		dclk_status_changed();
+	}
+
+	return sizeof(value);
+}
+
+/* Notification fan-out. Subscriptions are tracked per connection by the
+ * GATT layer, so each connected display is checked on its own.
+ */
+struct dclk_notify_ctx
+{
+	const struct bt_gatt_attr *attr;
+	const struct bt_gatt_attr *unless; // skip displays subscribed to this
+	const void *data;
+	uint16_t len;
+	int sent;
+	int err;
+};
+
+static void dclk_notify_complete(struct bt_conn *conn, void *user_data)
+{
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - (uint32_t)(uintptr_t)user_data);
+
+	dclk_status.notify_sent++;
+	boot_mark(BOOT_LIVE);
+	if (us > dclk_status.notify_latency_max_us)
+	{
+		dclk_status.notify_latency_max_us = us;
+	}
+}
+
+static void dclk_notify_conn(struct bt_conn *conn, void *user_data)
 {
-	notify_state_enabled = (value == BT_GATT_CCC_NOTIFY);
+	struct dclk_notify_ctx *ctx = user_data;
+
+	if (!bt_gatt_is_subscribed(conn, ctx->attr, BT_GATT_CCC_NOTIFY) ||
+		(ctx->unless && bt_gatt_is_subscribed(conn, ctx->unless, BT_GATT_CCC_NOTIFY)))
+	{
+		return;
+	}
+
+	struct bt_gatt_notify_params params = {
+		.attr = ctx->attr,
+		.data = ctx->data,
+		.len = ctx->len,
+		.func = dclk_notify_complete,
+		.user_data = (void *)(uintptr_t)k_cycle_get_32(),
+	};
+
+	int err = bt_gatt_notify_cb(conn, &params);
+	if (err)
+	{
+		trace_event(TRACE_NOTIFY_ERR, (uint16_t)-err);
+		dclk_status.notify_dropped++;
+		ctx->err = err;
+		return;
+	}
+	ctx->sent++;
 }
 
-/* clock configuration change callback function */
-static void dclk_ccc_clock_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
+static int dclk_notify_all(const struct bt_gatt_attr *attr, const struct bt_gatt_attr *unless,
+						   const void *data, uint16_t len)
 {
-	notify_clock_enabled = (value == BT_GATT_CCC_NOTIFY);
+	struct dclk_notify_ctx ctx = {
+		.attr = attr,
+		.unless = unless,
+		.data = data,
+		.len = len,
+	};
+
+	bt_conn_foreach(BT_CONN_TYPE_LE, dclk_notify_conn, &ctx);
+
+	if (ctx.sent)
+	{
+		return 0;
+	}
+
+	return ctx.err ? ctx.err : -EACCES;
 }
 
 static ssize_t read_state(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
@@ -272,6 +723,57 @@ static ssize_t read_clock(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 
 	return 0;
 }
+static void sync_encode(const struct dclk_sync *sync, uint8_t *buf)
+{
+	sys_put_le16(sync->seq, &buf[DCLK_SYNC_SEQ_OFS]);
+	buf[DCLK_SYNC_STATE_OFS] = sync->state;
+	buf[DCLK_SYNC_FLAGS_OFS] = sync->flags;
+	sys_put_le32(sync->remaining, &buf[DCLK_SYNC_CLOCK_OFS]);
+	sys_put_le32(sync->stamp, &buf[DCLK_SYNC_STAMP_OFS]);
+	sys_put_le32(sync->deadline, &buf[DCLK_SYNC_DEADLINE_OFS]);
+	sys_put_le16(sync->epoch, &buf[DCLK_SYNC_EPOCH_OFS]);
+}
+
+static ssize_t read_bkey(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+						 uint16_t len, uint16_t offset)
+{
+	LOG_DBG("Attribute read, handle: %u, conn: %p", attr->handle, (void *)conn);
+
+	if (!bcast_key_valid)
+	{
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, bcast_key, sizeof(bcast_key));
+}
+
+/* Events leading up to the last reset, long reads take it in pieces */
+static ssize_t read_trace(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+						  uint16_t len, uint16_t offset)
+{
+	size_t report_len;
+	const uint8_t *report = trace_report(&report_len);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, report, report_len);
+}
+
+static ssize_t read_sync(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+						 uint16_t len, uint16_t offset)
+{
+	const uint8_t *value = attr->user_data;
+
+	LOG_DBG("Attribute read, handle: %u, conn: %p", attr->handle, (void *)conn);
+
+	if (dclk_cb.sync_cb)
+	{
+		dclk_cb.sync_cb(&sync);
+		sync.seq = sync_seq;
+		sync_encode(&sync, sync_buf);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, value, DCLK_SYNC_LEN);
+	}
+
+	return 0;
+}
 /*
 
 
@@ -325,6 +827,24 @@ static struct bt_conn_auth_cb auth_cb_display = {
 
 */
 /*PAIRING*/
+static void bond_added(struct bt_conn *conn, bool bonded)
+{
+	if (bonded)
+	{
+		accept_list_dirty = true;
+	}
+}
+
+static void bond_deleted(uint8_t id, const bt_addr_le_t *peer)
+{
+	accept_list_dirty = true;
+}
+
+static struct bt_conn_auth_info_cb bond_info_callbacks = {
+	.pairing_complete = bond_added,
+	.bond_deleted = bond_deleted,
+};
+
 #ifdef DCLK_INFO
 static void pairing_complete(struct bt_conn *conn, bool bonded)
 {
@@ -361,12 +881,25 @@ BT_GATT_SERVICE_DEFINE(
 	BT_GATT_CHARACTERISTIC(BT_UUID_DCLK_STATE, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
 						   BT_GATT_PERM_READ_AUTHEN, read_state, NULL, &state),
 	/* Client Characteristic Configuration Descriptor */
-	BT_GATT_CCC(dclk_ccc_state_cfg_changed, BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN),
 
 	BT_GATT_CHARACTERISTIC(BT_UUID_DCLK_CLOCK, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
 						   BT_GATT_PERM_READ_AUTHEN, read_clock, NULL, &clock),
 
-	BT_GATT_CCC(dclk_ccc_clock_cfg_changed, BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN),
+
+	BT_GATT_CHARACTERISTIC(BT_UUID_DCLK_SYNC, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+						   BT_GATT_PERM_READ_AUTHEN, read_sync, NULL, sync_buf),
+
+	BT_GATT_CCC_MANAGED(((struct _bt_gatt_ccc[]){
+							BT_GATT_CCC_INITIALIZER(NULL, dclk_ccc_sync_cfg_write, NULL)}),
+						BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_WRITE_AUTHEN),
+
+	BT_GATT_CHARACTERISTIC(BT_UUID_DCLK_BKEY, BT_GATT_CHRC_READ,
+						   BT_GATT_PERM_READ_AUTHEN, read_bkey, NULL, NULL),
+
+	BT_GATT_CHARACTERISTIC(BT_UUID_DCLK_TRACE, BT_GATT_CHRC_READ,
+						   BT_GATT_PERM_READ_AUTHEN, read_trace, NULL, NULL),
 
 );
 
@@ -376,6 +909,57 @@ BT_GATT_SERVICE_DEFINE(
 */
 
 /*API*/
+/** @brief Finishes dclk_init once the Bluetooth stack is up
+ *
+ * Runs on the system workqueue. Only the settings this service needs
+ * are loaded, then advertising and anything requested in the meantime
+ * is started.
+ */
+static void dclk_bt_ready(int err)
+{
+	if (err)
+	{
+		LOG_ERR("Bluetooth enable failed (err %d)\n", err);
+		return;
+	}
+	boot_mark(BOOT_BT_READY);
+
+	if (IS_ENABLED(CONFIG_SETTINGS))
+	{
+		// bonds, CCCs and identity, then the broadcast key
+		err = settings_load_subtree("bt");
+		if (!err)
+		{
+			err = settings_load_subtree("dclk");
+		}
+		if (err)
+		{
+			LOG_ERR("Bluetooth load settings failed (err %d)\n", err);
+			return;
+		}
+		LOG_INF("BLE settings loaded \n");
+	}
+	boot_mark(BOOT_SETTINGS);
+
+	if (!bcast_key_valid)
+	{
+		bcast_key_new();
+	}
+
+	dclk_ready = true;
+	k_work_submit(&advertise_DCLK_work);
+
+	if (reconnect_pending)
+	{
+		reconnect_pending = false;
+		dclk_reconnect_start();
+	}
+	if (bcast_en)
+	{
+		dclk_broadcast(true);
+	}
+}
+
 int dclk_init(struct dclk_cb *callbacks)
 {
 	int err;
@@ -385,18 +969,20 @@ int dclk_init(struct dclk_cb *callbacks)
 	{
 		dclk_cb.clock_cb = callbacks->clock_cb;
 		dclk_cb.state_cb = callbacks->state_cb;
+		dclk_cb.sync_cb = callbacks->sync_cb;
+		dclk_cb.status_cb = callbacks->status_cb;
 	}
-	err = bt_enable(NULL);
+
+	err = bt_conn_auth_cb_register(&auth_cb_display);
 	if (err)
 	{
-		LOG_ERR("Bluetooth enable failed (err %d)\n", err);
+		LOG_ERR("Bluetooth authetication register failed (err %d)\n", err);
 		return err;
 	}
-
-	err = bt_conn_auth_cb_register(&auth_cb_display);
+	err = bt_conn_auth_info_cb_register(&bond_info_callbacks);
 	if (err)
 	{
-		LOG_ERR("Bluetooth authetication register failed (err %d)\n", err);
+		LOG_ERR("Bluetooth bond info register failed (err %d)\n", err);
 		return err;
 	}
 #ifdef DCLK_INFO
@@ -408,26 +994,14 @@ int dclk_init(struct dclk_cb *callbacks)
 	}
 #endif
 
-	if (IS_ENABLED(CONFIG_SETTINGS))
+	// returns at once, the caller brings up the OLED while the radio starts
+	err = bt_enable(dclk_bt_ready);
+	if (err)
 	{
-		err = settings_load();
-		if (err)
-		{
-			LOG_ERR("Bluetooth load settings failed (err %d)\n", err);
-			return err;
-		}
-		LOG_INF("BLE settings loaded \n");
+		LOG_ERR("Bluetooth enable failed (err %d)\n", err);
+		return err;
 	}
 
-	// err = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), sd,
-	// 					  ARRAY_SIZE(sd));
-
-	// if (err)
-	// {
-	// 	err = -1;
-	// }
-	k_work_submit(&advertise_DCLK_work);
-
 	return 0;
 }
 
@@ -435,6 +1009,7 @@ int dclk_pairing(bool enable)
 {
 
 	dclk_status.pair_en = enable;
+	dclk_status_changed();
 	if (enable)
 	{
 		k_work_submit(&pair_DCLK_work);
@@ -449,27 +1024,125 @@ int dclk_pairing(bool enable)
 
 int dclk_send_state_notify(uint8_t *state)
 {
-	if (!notify_state_enabled)
+	// displays on the sync record get the state from there
+	return dclk_notify_all(&dclk_svc.attrs[2], &dclk_svc.attrs[8], state, sizeof(*state));
+}
+
+int dclk_send_clock_notify(uint32_t *clock)
+{
+	//LOG_INF("clock_notify = %d  l=%d", *clock, sizeof(*clock));
+	return dclk_notify_all(&dclk_svc.attrs[5], &dclk_svc.attrs[8], clock, sizeof(*clock));
+}
+
+int dclk_send_sync_notify(struct dclk_sync *sync)
+{
+	uint8_t frame[DCLK_SYNC_LEN];
+
+	sync->seq = ++sync_seq;
+	if (dclk_status.pair_en)
 	{
-		return -EACCES;
+		sync->flags |= DCLK_SYNC_FLAG_PAIRING;
 	}
-	
-	return bt_gatt_notify(NULL, &dclk_svc.attrs[2], state, sizeof(*state));
+	if (bcast_en)
+	{
+		sync->flags |= DCLK_SYNC_FLAG_BROADCAST;
+	}
+	sync_encode(sync, frame);
+	bcast_update(frame);
+
+	return dclk_notify_all(&dclk_svc.attrs[8], NULL, frame, sizeof(frame));
 }
 
-int dclk_send_clock_notify(uint32_t *clock)
+int dclk_conn_active(bool active)
 {
-	if (!notify_clock_enabled)
+	if (active != conn_active)
 	{
-		return -EACCES;
+		conn_active = active;
+		k_work_submit(&conn_param_work);
 	}
-	//LOG_INF("clock_notify = %d  l=%d", *clock, sizeof(*clock));
-	return bt_gatt_notify(NULL, &dclk_svc.attrs[5], clock, sizeof(*clock));
+
+	return 0;
+}
+
+int dclk_last_peer(bt_addr_le_t *peer)
+{
+	if (!last_peer_valid)
+	{
+		return -ENOENT;
+	}
+	bt_addr_le_copy(peer, &last_peer);
+
+	return 0;
+}
+
+static int dclk_reconnect_start(void)
+{
+	if (!bt_addr_le_is_bonded(BT_ID_DEFAULT, &reconnect_peer))
+	{
+		return -ENOENT;
+	}
+
+	reconnect_time = k_uptime_get_32();
+	k_work_submit(&reconnect_DCLK_work);
+
+	return 0;
+}
+
+int dclk_reconnect(const bt_addr_le_t *peer)
+{
+	if (dclk_status.pair_en)
+	{
+		return -EBUSY;
+	}
+
+	bt_addr_le_copy(&reconnect_peer, peer);
+	if (!dclk_ready)
+	{
+		// bonds are not loaded yet, dclk_bt_ready checks and starts it
+		reconnect_pending = true;
+		return 0;
+	}
+
+	return dclk_reconnect_start();
+}
+
+int dclk_broadcast(bool enable)
+{
+	int err = 0;
+
+	if (!IS_ENABLED(CONFIG_BT_PER_ADV))
+	{
+		return -ENOTSUP;
+	}
+
+	if (!dclk_ready)
+	{
+		// applied by dclk_bt_ready
+		bcast_en = enable;
+		return 0;
+	}
+
+	if (enable)
+	{
+		err = bcast_start();
+	}
+	else
+	{
+		bcast_stop();
+	}
+
+	bcast_en = enable && !err;
+	dclk_status.bcast_en = bcast_en;
+	dclk_status_changed();
+
+	return err;
 }
 
 int dclk_get_status(struct dclk_info *status)
 {
-	status->num_conn = dclk_status.num_conn;
-	status->pair_en = dclk_status.pair_en;
+	dclk_status.num_conn = 0;
+	bt_conn_foreach(BT_CONN_TYPE_LE, dclk_count_conn, &dclk_status.num_conn);
+
+	*status = dclk_status;
 	return 0;
 }
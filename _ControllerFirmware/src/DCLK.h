@@ -20,6 +20,8 @@ extern "C"
 #endif
 
 #include <zephyr/types.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/bluetooth/addr.h>
 
 /** @brief DCLK Service UUID. */
 #define BT_UUID_DCLK_VAL BT_UUID_128_ENCODE(0x00001553, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
@@ -36,10 +38,25 @@ extern "C"
 #define BT_UUID_DCLK_CLOCK_VAL \
 	BT_UUID_128_ENCODE(0x00001556, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
 
+/** @brief Sync Characteristic UUID. */
+#define BT_UUID_DCLK_SYNC_VAL \
+	BT_UUID_128_ENCODE(0x00001557, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
+
+/** @brief Broadcast Key Characteristic UUID. */
+#define BT_UUID_DCLK_BKEY_VAL \
+	BT_UUID_128_ENCODE(0x00001558, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
+
+/** @brief Event Trace Characteristic UUID. */
+#define BT_UUID_DCLK_TRACE_VAL \
+	BT_UUID_128_ENCODE(0x00001559, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
+
 #define BT_UUID_DCLK BT_UUID_DECLARE_128(BT_UUID_DCLK_VAL)
 #define BT_UUID_DCLK_STATE BT_UUID_DECLARE_128(BT_UUID_DCLK_STATE_VAL)
 #define BT_UUID_DCLK_LED BT_UUID_DECLARE_128(BT_UUID_DCLK_LED_VAL)
 #define BT_UUID_DCLK_CLOCK BT_UUID_DECLARE_128(BT_UUID_DCLK_CLOCK_VAL)
+#define BT_UUID_DCLK_SYNC BT_UUID_DECLARE_128(BT_UUID_DCLK_SYNC_VAL)
+#define BT_UUID_DCLK_BKEY BT_UUID_DECLARE_128(BT_UUID_DCLK_BKEY_VAL)
+#define BT_UUID_DCLK_TRACE BT_UUID_DECLARE_128(BT_UUID_DCLK_TRACE_VAL)
 
 
 /** @brief Struct defining DCLK state */
@@ -49,9 +66,76 @@ extern "C"
 		uint8_t num_conn;
 		/** pairing status */
 		bool pair_en;
+		/** periodic advertising broadcast status */
+		bool bcast_en;
+		/** notifications handed to the controller, all connections */
+		uint32_t notify_sent;
+		/** notifications that could not be queued */
+		uint32_t notify_dropped;
+		/** worst notify-to-sent time, local TX complete only. The
+		 *  display measures notify-to-receive from the sync stamp.
+		 */
+		uint32_t notify_latency_max_us;
+		/** last connection interval reported by a peer, 1.25 ms units */
+		uint16_t conn_interval;
 
 	}dclk_info;
 
+	/** @brief Struct defining a clock sync record
+	 *
+	 * Times are in ms of controller uptime. The display maps them onto
+	 * its own uptime and counts down locally between records.
+	 */
+	typedef struct dclk_sync
+	{
+		/** controller uptime when the record was built */
+		uint32_t stamp;
+		/** controller uptime at which the clock expires, valid while running */
+		uint32_t deadline;
+		/** time remaining at stamp */
+		uint32_t remaining;
+		/** incremented on every start, stop and expiry */
+		uint16_t epoch;
+		/** incremented on every notification, set by the service */
+		uint16_t seq;
+		/** clock state, see dclk_send_state_notify */
+		uint8_t state;
+		/** DCLK_SYNC_FLAG_* bits */
+		uint8_t flags;
+	} dclk_sync;
+
+/** @brief Sync record wire format
+ *
+ * One fixed-layout little-endian record carries clock and state so the
+ * two can never be seen out of step.
+ */
+#define DCLK_SYNC_SEQ_OFS 0
+#define DCLK_SYNC_STATE_OFS 2
+#define DCLK_SYNC_FLAGS_OFS 3
+#define DCLK_SYNC_CLOCK_OFS 4
+#define DCLK_SYNC_STAMP_OFS 8
+#define DCLK_SYNC_DEADLINE_OFS 12
+#define DCLK_SYNC_EPOCH_OFS 16
+#define DCLK_SYNC_LEN 18
+
+/** Record was sent because of a state or connection event */
+#define DCLK_SYNC_FLAG_EVENT BIT(0)
+/** Controller is in pairing mode */
+#define DCLK_SYNC_FLAG_PAIRING BIT(1)
+/** Record is also broadcast in periodic advertising */
+#define DCLK_SYNC_FLAG_BROADCAST BIT(2)
+
+/** @brief Broadcast format
+ *
+ * Manufacturer data in periodic advertising: company id, sync record,
+ * then a truncated AES CBC-MAC over the record.
+ */
+#define DCLK_COMPANY_ID 0xFFFF
+#define DCLK_MAC_LEN 4
+#define DCLK_BCAST_LEN (2 + DCLK_SYNC_LEN + DCLK_MAC_LEN)
+/** periodic advertising interval, 1.25 ms units */
+#define DCLK_BCAST_INTERVAL 80
+
 
 	
 	/** @brief get status of DCLK service
@@ -73,6 +157,12 @@ extern "C"
 	/** @brief Callback type for when state is read. */
 	typedef uint8_t (*state_cb_t)(void);
 
+	/** @brief Callback type for when the sync record is read. */
+	typedef void (*sync_cb_t)(struct dclk_sync *sync);
+
+	/** @brief Callback type for when the connection or pairing status changes. */
+	typedef void (*status_cb_t)(void);
+
 
 
 	/** @brief Callback struct used by DCLK Service. */
@@ -82,7 +172,10 @@ extern "C"
 		clock_cb_t clock_cb;
 		/** state read callback. */
 		state_cb_t state_cb;
-
+		/** sync record read callback. */
+		sync_cb_t sync_cb;
+		/** status changed callback. */
+		status_cb_t status_cb;
 
 	};
 
@@ -114,6 +207,54 @@ extern "C"
 	 */
 	int dclk_pairing(bool enable);
 
+	/** @brief Enables/Disables the connectionless broadcast
+	 *
+	 * While enabled every sync record is also carried in periodic
+	 * advertising, authenticated with a key that bonded displays read
+	 * over the DCLK service. Connectable advertising is unaffected.
+	 *
+	 * @param[in] enable enables on true and disables on false
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int dclk_broadcast(bool enable);
+
+	/** @brief Select the connection parameters for all displays
+	 *
+	 * Active uses a 7.5 - 15 ms interval so clock events reach the
+	 * displays quickly, longer with several displays so every link still
+	 * gets its event. Idle uses a long interval with peripheral latency
+	 * to save radio time. Connections are only updated on a change.
+	 *
+	 * @param[in] active true while the clock is running
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int dclk_conn_active(bool active);
+
+	/** @brief Get the display that connected most recently
+	 *
+	 * @param[out] peer identity address of the display
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           -ENOENT if nothing connected since boot.
+	 */
+	int dclk_last_peer(bt_addr_le_t *peer);
+
+	/** @brief Reconnect a known display straight away
+	 *
+	 * Starts directed advertising to the peer, falling back to the
+	 * accept list when it times out. Used after waking from System OFF.
+	 *
+	 * @param[in] peer bonded display to reconnect
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           -ENOENT if the peer is not bonded, -EBUSY while pairing.
+	 */
+	int dclk_reconnect(const bt_addr_le_t *peer);
+
 	/** @brief Send the clock state as notification.
 	 *
 	 * This function sends a uint8_t state. The state can be
@@ -140,6 +281,19 @@ extern "C"
 	 */
 	int dclk_send_clock_notify(uint32_t *clock);
 
+	/** @brief Send the clock sync record as notification.
+	 *
+	 * This function sends the expiry deadline and run/pause epoch so
+	 * displays can count down between notifications. It only needs to
+	 * be sent on state transitions and periodic re-syncs.
+	 *
+	 * @param[in,out] sync The sync record, seq is assigned here
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int dclk_send_sync_notify(struct dclk_sync *sync);
+
 #ifdef __cplusplus
 }
 #endif
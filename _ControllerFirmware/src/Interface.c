@@ -13,6 +13,12 @@
 #include <zephyr/settings/settings.h>
 
 #include "Interface.h"
+#include "Oled.h"
+#include "Buzzer.h"
+#include "Boot.h"
+#include "Trace.h"
+#include "Radio.h"
+#include "digits.h"
 
 #include <stdint.h>
 #include <zephyr/drivers/display.h>
@@ -20,7 +26,6 @@
 
 #include <zephyr/sys/printk.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/drivers/pwm.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,33 +40,176 @@ static const struct device *display = DEVICE_DT_GET(DT_NODELABEL(ssd1306));
 #define SW2_NODE DT_NODELABEL(button2)
 #define SW3_NODE DT_NODELABEL(button3)
 
-// PWM
+/*
+
+
+*/
+/* Button Input Engine */
+/* The ISR only timestamps the edge and pushes it into a single producer,
+ * single consumer ring. The system workqueue drains the ring, debounces
+ * on time and turns edges into events, so no edge is merged or lost
+ * while a previous one is still being handled.
+ */
+#define INPUT_RING_SIZE 32 // power of two
+#define BTN_DEBOUNCE_MS 20
+
+struct input_edge
+{
+	struct button_t *btn;
+	uint32_t time;	 // uptime ms, for debounce and gestures
+	uint32_t cycles; // for latency
+	uint8_t level;
+};
+
+static struct input_edge input_ring[INPUT_RING_SIZE];
+static atomic_t input_head; // written by the ISR only
+static atomic_t input_tail; // written by the workqueue only
+static uint32_t input_dropped;
+
+static void button_schedule(struct button_t *btn, uint32_t now);
+
+static void button_emit(struct button_t *btn, uint8_t evt, uint32_t cycles)
+{
+	btn->evt = evt;
+	if (cycles)
+	{
+		uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - cycles);
+
+		if (us > btn->latency_max_us)
+		{
+			btn->latency_max_us = us;
+			LOG_INF("Pin %d edge-to-callback max = %d us", btn->gpio_spec.pin, us);
+		}
+	}
+
+	if (btn->active_func_cb)
+	{
+		btn->active_func_cb(evt);
+	}
+}
+
+static void button_accept(struct button_t *btn, uint8_t level, uint32_t time, uint32_t cycles)
+{
+	if (level == btn->val)
+	{
+		return;
+	}
+
+	btn->val = level;
+	btn->edge_time = time;
+	btn->settling = true;
+	trace_event(TRACE_BUTTON, (btn->gpio_spec.pin << 8) | level);
+
+	if (level)
+	{
+		bool twice = (btn->type & BTN_GESTURE_DOUBLE) && btn->release_time &&
+					 ((time - btn->release_time) < BTN_DOUBLE_MS);
+
+		btn->push_time = time;
+		btn->sent = 0;
+		button_emit(btn, BTN_EVT_PUSH, cycles);
+		if (twice)
+		{
+			btn->release_time = 0; // a third push starts a new pair
+			button_emit(btn, BTN_EVT_DOUBLE, 0);
+		}
+	}
+	else
+	{
+		btn->release_time = time;
+		button_emit(btn, BTN_EVT_RELEASE, cycles);
+	}
+}
+
+static void button_edge(const struct input_edge *edge)
+{
+	struct button_t *btn = edge->btn;
+
+	// bounces inside the window are dropped, the settle check reads the final level
+	if (btn->settling && ((edge->time - btn->edge_time) < btn->debounce))
+	{
+		return;
+	}
+	button_accept(btn, edge->level, edge->time, edge->cycles);
+	button_schedule(btn, edge->time);
+}
+
+static void input_drain(struct k_work *work)
+{
+	static uint32_t dropped_seen;
+	atomic_val_t tail = atomic_get(&input_tail);
+
+	if (dropped_seen != input_dropped)
+	{
+		dropped_seen = input_dropped;
+		LOG_WRN("Input ring full, %d edges dropped", dropped_seen);
+	}
 
-#define MIN_PERIOD PWM_MSEC(2U) / 128U
-#define MAX_PERIOD PWM_MSEC(2U)
+	while (tail != atomic_get(&input_head))
+	{
+		button_edge(&input_ring[tail & (INPUT_RING_SIZE - 1)]);
+		tail++;
+		atomic_set(&input_tail, tail);
+	}
+}
 
-static const struct pwm_dt_spec pwm_buzz = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0));
+K_WORK_DEFINE(input_work, input_drain);
 
 /*
 
 
 */
-/* Button Event Handler */
+/*Button Timers*/
 
-void handle_button_event(struct k_work *work)
+static void button_schedule(struct button_t *btn, uint32_t now)
 {
-	LOG_DBG("handle_button_event");
-	struct button_t *btn = CONTAINER_OF(work, struct button_t, btn_work);
-	if (0 == btn->val)
+	int32_t next = INT32_MAX;
+
+	if (btn->settling)
 	{
-		btn->evt = 0;
+		next = MIN(next, (int32_t)(btn->edge_time + btn->debounce - now));
 	}
-	else
+	if (btn->val && (btn->type & BTN_GESTURE_HOLD) && !(btn->sent & BTN_GESTURE_HOLD))
+	{
+		next = MIN(next, (int32_t)(btn->push_time + BTN_HOLD_MS - now));
+	}
+	if (btn->val && (btn->type & BTN_GESTURE_LONG) && !(btn->sent & BTN_GESTURE_LONG))
 	{
-		btn->evt = 1;
+		next = MIN(next, (int32_t)(btn->push_time + BTN_LONG_MS - now));
 	}
 
-	btn->active_func_cb(btn->evt);
+	if (INT32_MAX != next)
+	{
+		k_work_reschedule(&btn->btn_timer, K_MSEC(MAX(next, 0)));
+	}
+}
+
+static void button_timer(struct k_work *work)
+{
+	struct button_t *btn = CONTAINER_OF(k_work_delayable_from_work(work), struct button_t, btn_timer);
+	uint32_t now = k_uptime_get_32();
+
+	if (btn->settling && ((now - btn->edge_time) >= btn->debounce))
+	{
+		btn->settling = false;
+		// catches an edge that bounced back inside the window
+		button_accept(btn, gpio_pin_get_dt(&btn->gpio_spec) > 0, now, 0);
+	}
+
+	if (btn->val && (btn->type & BTN_GESTURE_HOLD) && !(btn->sent & BTN_GESTURE_HOLD) &&
+		((now - btn->push_time) >= BTN_HOLD_MS))
+	{
+		btn->sent |= BTN_GESTURE_HOLD;
+		button_emit(btn, BTN_EVT_HOLD, 0);
+	}
+	if (btn->val && (btn->type & BTN_GESTURE_LONG) && !(btn->sent & BTN_GESTURE_LONG) &&
+		((now - btn->push_time) >= BTN_LONG_MS))
+	{
+		btn->sent |= BTN_GESTURE_LONG;
+		button_emit(btn, BTN_EVT_LONG, 0);
+	}
+
+	button_schedule(btn, now);
 }
 
 /*
@@ -72,12 +220,25 @@ void handle_button_event(struct k_work *work)
 
 static void button_event_cb(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
 {
-	LOG_DBG("button_event_cb");
 	struct button_t *btn = CONTAINER_OF(cb, struct button_t, gpio_cb_data);
-	btn->val = gpio_pin_get(btn->gpio_spec.port, btn->gpio_spec.pin);
-	LOG_INF("Pin %d = %d", btn->gpio_spec.pin, btn->val);
+	atomic_val_t head = atomic_get(&input_head);
 
-	k_work_submit(&btn->btn_work);
+	if ((head - atomic_get(&input_tail)) >= INPUT_RING_SIZE)
+	{
+		input_dropped++;
+	}
+	else
+	{
+		input_ring[head & (INPUT_RING_SIZE - 1)] = (struct input_edge){
+			.btn = btn,
+			.time = k_uptime_get_32(),
+			.cycles = k_cycle_get_32(),
+			.level = gpio_pin_get(btn->gpio_spec.port, btn->gpio_spec.pin) > 0,
+		};
+		atomic_set(&input_head, head + 1);
+	}
+
+	k_work_submit(&input_work);
 }
 
 static void pair_btn_cb(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
@@ -97,43 +258,43 @@ static void stop_btn_cb(const struct device *dev, struct gpio_callback *cb, uint
 
 static struct button_t pair_btn =
 	{
-		.val = 1,
+		.val = 0,
 		.evt = 0,
+		.debounce = BTN_DEBOUNCE_MS,
+		.type = BTN_GESTURE_HOLD | BTN_GESTURE_LONG,
 		.gpio_spec = GPIO_DT_SPEC_GET(SW0_NODE, gpios),
 		.gpio_cb_handler = button_event_cb,
-		.gpio_flags = GPIO_ACTIVE_LOW,
-
-		.btn_work_handler = handle_button_event,
+		.gpio_flags = GPIO_INT_EDGE_BOTH,
 };
 static struct button_t user_btn =
 	{
-		.val = 2,
+		.val = 0,
 		.evt = 0,
+		.debounce = BTN_DEBOUNCE_MS,
+		.type = BTN_GESTURE_HOLD | BTN_GESTURE_LONG | BTN_GESTURE_DOUBLE,
 		.gpio_spec = GPIO_DT_SPEC_GET(SW1_NODE, gpios),
 		.gpio_cb_handler = button_event_cb,
 		.gpio_flags = GPIO_INT_EDGE_BOTH,
-		.btn_work_handler = handle_button_event,
-
 };
 static struct button_t start_btn =
 	{
-		.val = 3,
+		.val = 0,
 		.evt = 0,
+		.debounce = BTN_DEBOUNCE_MS,
+		.type = 0, // push and release only, for the lowest latency
 		.gpio_spec = GPIO_DT_SPEC_GET(SW2_NODE, gpios),
 		.gpio_cb_handler = button_event_cb,
 		.gpio_flags = GPIO_INT_EDGE_BOTH,
-
-		.btn_work_handler = handle_button_event,
 };
 static struct button_t stop_btn =
 	{
-		.val = 4,
+		.val = 0,
 		.evt = 0,
+		.debounce = BTN_DEBOUNCE_MS,
+		.type = 0,
 		.gpio_spec = GPIO_DT_SPEC_GET(SW3_NODE, gpios),
 		.gpio_cb_handler = button_event_cb,
 		.gpio_flags = GPIO_INT_EDGE_BOTH,
-
-		.btn_work_handler = handle_button_event,
 };
 
 /*
@@ -149,6 +310,13 @@ int setup_button(struct button_t *button, active_func user_cb)
 	int err = !device_is_ready(button->gpio_spec.port);
 
 	gpio_pin_configure_dt(&button->gpio_spec, GPIO_INPUT | GPIO_PULL_UP);
+	button->val = gpio_pin_get_dt(&button->gpio_spec) > 0;
+
+	/* WORK */
+
+	k_work_init_delayable(&button->btn_timer, button_timer);
+
+	button->active_func_cb = user_cb;
 
 	/*Interrupt*/
 
@@ -158,58 +326,31 @@ int setup_button(struct button_t *button, active_func user_cb)
 
 	err = abs(gpio_add_callback(button->gpio_spec.port, &button->gpio_cb_data));
 
-	/* WORK */
-
-	k_work_init(&button->btn_work, handle_button_event);
-
-	button->active_func_cb = user_cb;
-
 	return err;
 }
 
-int buzzer_init()
-{
-
-	if (!pwm_is_ready_dt(&pwm_buzz))
-	{
-		LOG_ERR("Error: PWM device %s is not ready\n",
-				pwm_buzz.dev->name);
-		return 0;
-	}
-
-	return 0;
-}
+// the render thread waits on this until init is done, the buzzer runs
+// from it even without a panel
+K_SEM_DEFINE(render_ready, 0, 1);
+static bool display_up;
 
 int display_init()
 {
-	int err = cfb_framebuffer_init(display);
-	if (err)
-	{
-		return err;
-	}
-	err = cfb_framebuffer_set_font(display, 1);
-	if (err)
-	{
-		return err;
-	}
-	err = cfb_print(display, "DCLK Start", 0, 0);
+	// CFB only supplies the fonts, Oled.c keeps the framebuffer
+	int err = oled_init(display, 1);
 	if (err)
 	{
 		return err;
 	}
-	err = cfb_framebuffer_invert(display);
-	if (err)
-	{
-		return err;
-	}
-	err = cfb_framebuffer_finalize(display);
-	if (err)
-	{
-		return err;
-	}
-	err = cfb_framebuffer_clear(display, true);
+	// the clock view is light on dark so every blit is a plain copy
+	oled_invert(false);
+	oled_clear();
 
-	return err;
+	// no splash, the first clock frame is the first full write
+	boot_mark(BOOT_DISPLAY);
+	display_up = true;
+
+	return 0;
 }
 
 int interface_init(struct interface_cb *app_cb)
@@ -227,92 +368,234 @@ int interface_init(struct interface_cb *app_cb)
 		return err;
 	}
 
+	// neither is fatal, the buzzer still sounds the clock without a panel
 	err = display_init();
 	if (err)
 	{
-		LOG_ERR("Failed to setup display");
-		return !err;
+		LOG_ERR("Failed to setup display (err %d)", err);
 	}
 
 	err = buzzer_init();
 	if (err)
 	{
-		LOG_ERR("Failed to setup buzzer");
-		return !err;
+		LOG_ERR("Failed to setup buzzer (err %d)", err);
 	}
+	k_sem_give(&render_ready);
 
 	return 0;
 }
 
-static void stop_buzz(struct k_timer *timer_id)
-{
-	pwm_set_dt(&pwm_buzz, 0, 0);
-}
+/*
 
-K_TIMER_DEFINE(buzz_timer, stop_buzz, NULL);
 
-void buzz()
+*/
+/*RENDER*/
+/* The app posts the latest view and returns at once. The render thread
+ * draws whatever is newest when it gets to run, so a slow bus drops
+ * intermediate frames instead of holding up the clock and BLE work.
+ * Buzzer patterns are posted the same way, since a start may wait for
+ * the PWM to stop and for the radio to go quiet.
+ */
+#define RENDER_STACKSIZE 1024
+#define RENDER_PRIORITY 10
+/* a flush waits at most this long for a radio event to end, under a frame */
+#define RENDER_RADIO_WAIT_MS 4
+
+struct view
 {
-	pwm_set_dt(&pwm_buzz, MAX_PERIOD, MAX_PERIOD / 2U);
-	k_timer_start(&buzz_timer, K_MSEC(500), K_NO_WAIT);
-}
+	uint32_t clock;
+	uint8_t state;
+	char conn_status;
+	uint8_t battery; // bars
+};
 
-static uint32_t dis_clock = 0;
-static uint8_t dis_state = 2;
-static char dis_conn_status = 0;
+static struct view view_posted = {
+	.state = 2,
+};
+static struct view view_mail;
+static bool view_fresh; // view_mail not drawn yet
+static struct k_spinlock view_lock;
+static uint32_t view_coalesced;
+static atomic_t buzz_mail; // pattern + 1, 0 for none
+
+K_SEM_DEFINE(view_sem, 0, 1);
+
+/* Held by the render thread for a whole frame, interface_off keeps it */
+K_MUTEX_DEFINE(render_lock);
+static bool render_stopped;
 
 int interface_off(void)
 {
+	// wait out the frame in flight, no frame follows once stopped
+	k_mutex_lock(&render_lock, K_FOREVER);
+	render_stopped = true;
 
-	int err = cfb_print(display, "OFF", 0, 0);
+	int err = oled_print("OFF", 0, 0);
+	if (!err)
+	{
+		err = oled_flush();
+	}
+	k_mutex_unlock(&render_lock);
+	return err;
 }
 
 
-int interface_update(uint32_t *clock, uint8_t *state, char *conn_status)
+/* Clock view layout, columns */
+#define VIEW_TENS_X 0
+#define VIEW_ONES_X 28
+#define VIEW_ICON_X 64
+#define VIEW_STATUS_X 112
+#define VIEW_STATUS_PAGE 2
+#define VIEW_BATT_X 112
+#define VIEW_BATT_PAGE 0
+
+/** @brief Compose the clock view from the pre-rendered bitmaps
+ *
+ * No fonts and no formatting, each element is one copy per page.
+ */
+static void interface_draw(uint32_t clock, uint8_t state, char conn_status, uint8_t battery)
 {
-	
-	int err = 0;
-	bool ref = (dis_clock == *clock) && (dis_state == *state) && (dis_conn_status == *conn_status);
-	if (!ref)
-	{
-		dis_clock = *clock;
-		dis_state = *state;
-		dis_conn_status = *conn_status;
-		char str[15];
-		if (10 == dis_clock)
+	uint8_t tens = DIGIT_BLANK;
+	uint8_t ones;
+	uint8_t status = DIGIT_BLANK;
+
+	// a full shot clock shows dashes, as the text view did
+	if (10 == clock)
+	{
+		tens = DIGIT_DASH;
+		ones = DIGIT_DASH;
+	}
+	else
+	{
+		clock = MIN(clock, 99);
+		if (clock >= 10)
 		{
-			sprintf(str, "T:- S%d %c", dis_state, dis_conn_status);
+			tens = clock / 10;
 		}
-		else
+		ones = clock % 10;
+	}
+
+	if ('P' == conn_status)
+	{
+		status = DIGIT_P;
+	}
+	else if ((conn_status >= '0') && (conn_status <= '9'))
+	{
+		status = conn_status - '0';
+	}
+
+	oled_blit(digit_big[tens], VIEW_TENS_X, 0, DIGIT_BIG_W, DIGIT_BIG_PAGES);
+	oled_blit(digit_big[ones], VIEW_ONES_X, 0, DIGIT_BIG_W, DIGIT_BIG_PAGES);
+	if (state < ARRAY_SIZE(icon_state))
+	{
+		oled_blit(icon_state[state], VIEW_ICON_X, 0, ICON_W, ICON_PAGES);
+	}
+	oled_blit(digit_small[status], VIEW_STATUS_X, VIEW_STATUS_PAGE, DIGIT_SMALL_W,
+			  DIGIT_SMALL_PAGES);
+	oled_blit(icon_battery[MIN(battery, BATT_BARS)], VIEW_BATT_X, VIEW_BATT_PAGE, BATT_W,
+			  BATT_PAGES);
+}
+
+int interface_update(uint32_t *clock, uint8_t *state, char *conn_status, uint8_t *battery)
+{
+	// round to the nearest bar, 0 bars is only shown below 1/8
+	uint8_t bars = (*battery * BATT_BARS + 50) / 100;
+	bool ref = (view_posted.clock == *clock) && (view_posted.state == *state) &&
+			   (view_posted.conn_status == *conn_status) && (view_posted.battery == bars);
+	if (ref)
+	{
+		// LOG_INF("Update not required");
+		return -1;
+	}
+
+	view_posted.clock = *clock;
+	view_posted.state = *state;
+	view_posted.conn_status = *conn_status;
+	view_posted.battery = bars;
+
+	k_spinlock_key_t key = k_spin_lock(&view_lock);
+	bool coalesced = view_fresh;
+
+	view_mail = view_posted;
+	view_fresh = true;
+	k_spin_unlock(&view_lock, key);
+
+	if (coalesced)
+	{
+		// the previous view was never drawn
+		view_coalesced++;
+		LOG_DBG("view coalesced (%d)", view_coalesced);
+	}
+	k_sem_give(&view_sem);
+
+	return 0;
+}
+
+int interface_buzz(enum buzzer_pattern pattern)
+{
+	if (pattern >= BUZZER_PATTERN_COUNT)
+	{
+		return -EINVAL;
+	}
+
+	// a newer pattern replaces one that has not started yet
+	atomic_set(&buzz_mail, pattern + 1);
+	k_sem_give(&view_sem);
+
+	return 0;
+}
+
+static void interface_render(void)
+{
+	struct view view;
+	bool fresh;
+
+	k_sem_take(&render_ready, K_FOREVER);
+
+	while (1)
+	{
+		k_sem_take(&view_sem, K_FOREVER);
+
+		atomic_val_t buzz = atomic_clear(&buzz_mail);
+		if (buzz)
 		{
-			sprintf(str, "T:%d S%d %c", dis_clock, dis_state, dis_conn_status);
+			buzzer_play(buzz - 1);
 		}
 
+		k_spinlock_key_t key = k_spin_lock(&view_lock);
+		view = view_mail;
+		fresh = view_fresh;
+		view_fresh = false;
+		k_spin_unlock(&view_lock, key);
 
-		
+		if (!fresh || !display_up)
+		{
+			continue;
+		}
 
-		int err = cfb_print(display, str, 0, 0);
-		if (err)
+		k_mutex_lock(&render_lock, K_FOREVER);
+		if (render_stopped)
 		{
-			LOG_ERR("Failed to print display");
-			return err;
+			k_mutex_unlock(&render_lock);
+			return;
 		}
-		err = cfb_framebuffer_finalize(display);
+
+		interface_draw(view.clock, view.state, view.conn_status, view.battery);
+
+		// start the I2C burst and the panel charge pump after a radio event
+		(void)radio_wait_quiet(RADIO_USER_OLED, K_MSEC(RENDER_RADIO_WAIT_MS));
+
+		// only the changed columns go out over I2C
+		int err = oled_flush();
+		k_mutex_unlock(&render_lock);
 		if (err)
 		{
 			LOG_ERR("Failed to write display");
-			return err;
-		}
-		if (dis_clock < 3)
-		{
-			buzz();
+			continue;
 		}
+		boot_mark(BOOT_FRAME);
 	}
-	else
-	{
-		err = -1;
-		//LOG_INF("Update not required");
-	}
+}
 
-	return err;
-}
\ No newline at end of file
+K_THREAD_DEFINE(render, RENDER_STACKSIZE, interface_render, NULL, NULL, NULL,
+				RENDER_PRIORITY, 0, 0);
\ No newline at end of file
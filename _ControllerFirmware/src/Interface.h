@@ -21,20 +21,45 @@ extern "C"
 #include <zephyr/devicetree.h>
 #include <zephyr/settings/settings.h>
 
+#include "Buzzer.h"
+
+/** @brief Button events */
+#define BTN_EVT_RELEASE 0
+#define BTN_EVT_PUSH 1
+#define BTN_EVT_HOLD 2
+#define BTN_EVT_LONG 3
+#define BTN_EVT_DOUBLE 4
+
+/** @brief Gestures a button reports on top of push and release, btn_t.type */
+#define BTN_GESTURE_HOLD BIT(0)
+#define BTN_GESTURE_LONG BIT(1)
+#define BTN_GESTURE_DOUBLE BIT(2)
+
+/** @brief Gesture timing in ms */
+#define BTN_HOLD_MS 1000
+#define BTN_LONG_MS 3000
+#define BTN_DOUBLE_MS 400
+
 	/** @brief
 	 *
 	 * @param evt the button event which just occurred
 	 * 0 release (falling edge)
 	 * 1 push (rising edge)
-	 * 2 hold (sustained push)
+	 * 2 hold (sustained push for BTN_HOLD_MS)
+	 * 3 long (sustained push for BTN_LONG_MS)
+	 * 4 double (push within BTN_DOUBLE_MS of the last release, after the push event)
 	 */
 	typedef uint8_t (*active_func)(uint8_t evt);
 
 	typedef struct button_t
 	{
+		/** debounced level, 1 pushed */
 		uint8_t val;
+		/** last event reported */
 		uint8_t evt;
+		/** ms an accepted edge masks further edges */
 		uint16_t debounce;
+		/** BTN_GESTURE_* bits */
 		uint8_t type;
 
 		const struct gpio_dt_spec gpio_spec;
@@ -42,8 +67,20 @@ extern "C"
 		gpio_flags_t gpio_flags;
 		gpio_callback_handler_t gpio_cb_handler;
 
-		struct k_work btn_work;
-		k_work_handler_t btn_work_handler;
+		/** uptime of the last accepted edge */
+		uint32_t edge_time;
+		/** uptime of the last push and release */
+		uint32_t push_time;
+		uint32_t release_time;
+		/** an accepted edge is still inside its debounce window */
+		bool settling;
+		/** BTN_GESTURE_* already reported for this push */
+		uint8_t sent;
+		/** worst edge-to-callback time */
+		uint32_t latency_max_us;
+
+		/** debounce settle and gesture deadlines */
+		struct k_work_delayable btn_timer;
 
 		active_func active_func_cb;
 	} btn_t;
@@ -78,16 +115,29 @@ extern "C"
 	 * written to the display
 	 *
 	 * @param[in] data void pointer to string data. a null value will clear display
+	 * @param[in] battery charge level in %, shown as a battery icon
 	 *
 	 * @retval 0 If the operation was successful.
 	 *           Otherwise, a (negative) error code is returned.
 	 */
-	int interface_update(uint32_t *clock, uint8_t *state, char *conn_status);
+	int interface_update(uint32_t *clock, uint8_t *state, char *conn_status, uint8_t *battery);
 
-/** @brief Turn off the display
+	/** @brief Play a buzzer pattern from the render thread
+	 *
+	 * Returns at once, the pattern starts once the render thread runs.
+	 * A pattern posted before the previous one started replaces it.
 	 *
+	 * @param[in] pattern pattern to play
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int interface_buzz(enum buzzer_pattern pattern);
+
+/** @brief Turn off the display
 	 *
-	 * @param[in] 
+	 * Waits for the frame being drawn, stops the render thread and
+	 * writes the OFF screen. Blocks on the bus, call from a thread.
 	 *
 	 * @retval 0 If the operation was successful.
 	 *           Otherwise, a (negative) error code is returned.
@@ -0,0 +1,254 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/display.h>
+#include <zephyr/display/cfb.h>
+#include <zephyr/sys/iterable_sections.h>
+
+#include <string.h>
+
+#include "Oled.h"
+
+LOG_MODULE_DECLARE(Controller_app, LOG_LEVEL_ERR);
+
+#define OLED_NODE DT_NODELABEL(ssd1306)
+#define OLED_WIDTH DT_PROP(OLED_NODE, width)
+#define OLED_PAGES (DT_PROP(OLED_NODE, height) / 8)
+
+/* Column and page address commands sent ahead of every write */
+#define OLED_ADDR_BYTES 8
+
+/*
+
+
+*/
+/*FRAMEBUFFER*/
+static const struct device *oled_dev;
+static const struct cfb_font *oled_font;
+static bool oled_inverted;
+
+/* fb is drawn into, panel mirrors what the SSD1306 holds */
+static uint8_t fb[OLED_PAGES][OLED_WIDTH];
+static uint8_t panel[OLED_PAGES][OLED_WIDTH];
+static bool panel_valid;
+
+static struct oled_stats stats;
+
+int oled_init(const struct device *dev, uint8_t font_idx)
+{
+	uint8_t idx = 0;
+
+	oled_dev = dev;
+	oled_font = NULL;
+
+	if (!device_is_ready(dev))
+	{
+		return -ENODEV;
+	}
+
+	STRUCT_SECTION_FOREACH(cfb_font, font)
+	{
+		if (idx++ == font_idx)
+		{
+			oled_font = font;
+			break;
+		}
+	}
+	if (!oled_font || !(oled_font->caps & CFB_FONT_MONO_VPACKED) || (oled_font->height % 8))
+	{
+		return -EINVAL;
+	}
+
+	memset(fb, 0, sizeof(fb));
+	panel_valid = false;
+
+	return display_blanking_off(dev);
+}
+
+void oled_clear(void)
+{
+	memset(fb, oled_inverted ? 0xFF : 0x00, sizeof(fb));
+}
+
+void oled_invert(bool invert)
+{
+	oled_inverted = invert;
+}
+
+static uint8_t oled_reverse(uint8_t byte)
+{
+	uint8_t out = 0;
+
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		out = (out << 1) | ((byte >> i) & 1);
+	}
+	return out;
+}
+
+/* Glyphs are column major, height / 8 bytes per column, LSB on top */
+static void oled_glyph(char c, uint16_t x, uint16_t page)
+{
+	const uint8_t font_pages = oled_font->height / 8;
+	const uint8_t *glyph = NULL;
+
+	if ((c >= oled_font->first_char) && (c <= oled_font->last_char))
+	{
+		glyph = (const uint8_t *)oled_font->data +
+				(c - oled_font->first_char) * oled_font->width * font_pages;
+	}
+
+	for (uint8_t gx = 0; (gx < oled_font->width) && (x + gx < OLED_WIDTH); gx++)
+	{
+		for (uint8_t gp = 0; (gp < font_pages) && (page + gp < OLED_PAGES); gp++)
+		{
+			uint8_t byte = glyph ? glyph[gx * font_pages + gp] : 0;
+
+			if (oled_font->caps & CFB_FONT_MSB_FIRST)
+			{
+				byte = oled_reverse(byte);
+			}
+			fb[page + gp][x + gx] = oled_inverted ? ~byte : byte;
+		}
+	}
+}
+
+int oled_print(const char *str, uint16_t x, uint16_t y)
+{
+	if (!oled_font)
+	{
+		return -ENODEV;
+	}
+	if ((y % 8) || (y / 8 >= OLED_PAGES))
+	{
+		return -EINVAL;
+	}
+
+	uint16_t page = y / 8;
+
+	for (; *str && (x < OLED_WIDTH); str++)
+	{
+		oled_glyph(*str, x, page);
+		x += oled_font->width;
+	}
+
+	// blank the rest of the line
+	for (uint8_t gp = 0; (gp < oled_font->height / 8) && (page + gp < OLED_PAGES); gp++)
+	{
+		if (x < OLED_WIDTH)
+		{
+			memset(&fb[page + gp][x], oled_inverted ? 0xFF : 0x00, OLED_WIDTH - x);
+		}
+	}
+
+	return 0;
+}
+
+void oled_blit(const uint8_t *bmp, uint16_t x, uint8_t page, uint16_t width, uint8_t pages)
+{
+	if (x >= OLED_WIDTH)
+	{
+		return;
+	}
+
+	uint16_t cols = MIN(width, OLED_WIDTH - x);
+
+	for (uint8_t p = 0; (p < pages) && (page + p < OLED_PAGES); p++)
+	{
+		const uint8_t *src = &bmp[p * width];
+
+		if (!oled_inverted)
+		{
+			memcpy(&fb[page + p][x], src, cols);
+			continue;
+		}
+		for (uint16_t i = 0; i < cols; i++)
+		{
+			fb[page + p][x + i] = ~src[i];
+		}
+	}
+}
+
+/*
+
+
+*/
+/*FLUSH*/
+static int oled_write_page(uint8_t page, uint16_t x0, uint16_t x1)
+{
+	struct display_buffer_descriptor desc = {
+		.buf_size = x1 - x0,
+		.width = x1 - x0,
+		.height = 8,
+		.pitch = x1 - x0,
+	};
+
+	int err = display_write(oled_dev, x0, page * 8, &desc, &fb[page][x0]);
+	if (!err)
+	{
+		memcpy(&panel[page][x0], &fb[page][x0], x1 - x0);
+		stats.bytes_last += (x1 - x0) + OLED_ADDR_BYTES;
+	}
+
+	return err;
+}
+
+int oled_flush(void)
+{
+	uint32_t start = k_cycle_get_32();
+	int err = 0;
+
+	if (!oled_dev)
+	{
+		return -ENODEV;
+	}
+
+	stats.bytes_last = 0;
+
+	for (uint8_t page = 0; (page < OLED_PAGES) && !err; page++)
+	{
+		uint16_t x0 = 0;
+		uint16_t x1 = OLED_WIDTH;
+
+		if (panel_valid)
+		{
+			// narrow to the changed span of this page
+			while ((x0 < x1) && (fb[page][x0] == panel[page][x0]))
+			{
+				x0++;
+			}
+			while ((x1 > x0) && (fb[page][x1 - 1] == panel[page][x1 - 1]))
+			{
+				x1--;
+			}
+		}
+
+		if (x0 < x1)
+		{
+			err = oled_write_page(page, x0, x1);
+		}
+	}
+
+	if (err)
+	{
+		panel_valid = false;
+		return err;
+	}
+	panel_valid = true;
+
+	if (stats.bytes_last)
+	{
+		stats.flushes++;
+		stats.bytes_full = OLED_PAGES * OLED_WIDTH + OLED_ADDR_BYTES;
+		stats.us_last = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+		stats.us_max = MAX(stats.us_max, stats.us_last);
+		LOG_DBG("flush %d bytes (full %d) %d us", stats.bytes_last, stats.bytes_full,
+				stats.us_last);
+	}
+
+	return 0;
+}
+
+void oled_stats_get(struct oled_stats *out)
+{
+	*out = stats;
+}
@@ -0,0 +1,108 @@
+#ifndef DCLK_OLED
+#define DCLK_OLED
+
+/**
+ * @file Oled.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Page framebuffer for the SSD1306 with partial flushes
+ *
+ * Text is drawn with the CFB font tables into a local copy of the panel
+ * memory. A flush compares it against what was last sent and only writes
+ * the changed column span of each changed page.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/types.h>
+#include <zephyr/device.h>
+#include <stdbool.h>
+
+	/** @brief Bus cost of the flushes */
+	struct oled_stats
+	{
+		/** flushes that wrote anything */
+		uint32_t flushes;
+		/** bytes of the last flush, pixel data plus addressing */
+		uint32_t bytes_last;
+		/** what the last flush would have cost as a full frame */
+		uint32_t bytes_full;
+		/** time spent in the last flush */
+		uint32_t us_last;
+		/** worst flush time */
+		uint32_t us_max;
+	};
+
+	/** @brief Bind the framebuffer to a display
+	 *
+	 * @param[in] dev SSD1306 device
+	 * @param[in] font_idx CFB font to draw with, same index as cfb_framebuffer_set_font
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int oled_init(const struct device *dev, uint8_t font_idx);
+
+	/** @brief Draw a line of text
+	 *
+	 * Columns to the right of the text, up to the end of the line, are
+	 * cleared so a shorter string does not leave stale glyphs. Text
+	 * past the right edge is clipped.
+	 *
+	 * @param[in] str text to draw
+	 * @param[in] x first column
+	 * @param[in] y first row, multiple of 8
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int oled_print(const char *str, uint16_t x, uint16_t y);
+
+	/** @brief Copy a pre-rendered bitmap into the framebuffer
+	 *
+	 * The bitmap is in panel order, width bytes per page and pages one
+	 * after the other, so each page is a single copy. Parts past the
+	 * panel edge are clipped.
+	 *
+	 * @param[in] bmp bitmap data
+	 * @param[in] x first column
+	 * @param[in] page first page (8 rows each)
+	 * @param[in] width bitmap width in columns
+	 * @param[in] pages bitmap height in pages
+	 */
+	void oled_blit(const uint8_t *bmp, uint16_t x, uint8_t page, uint16_t width, uint8_t pages);
+
+	/** @brief Clear the framebuffer, takes effect on the next flush */
+	void oled_clear(void);
+
+	/** @brief Draw light text on dark or dark text on light
+	 *
+	 * @param[in] invert applies to text, bitmaps and clears after the call
+	 */
+	void oled_invert(bool invert);
+
+	/** @brief Send the changed parts of the framebuffer to the panel
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int oled_flush(void);
+
+	/** @brief Copy the flush statistics
+	 *
+	 * @param[out] stats filled with the current statistics
+	 */
+	void oled_stats_get(struct oled_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_OLED */
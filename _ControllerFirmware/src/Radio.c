@@ -0,0 +1,148 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/irq.h>
+#include <zephyr/sys/atomic.h>
+
+#include <mpsl_radio_notification.h>
+
+#include "Radio.h"
+
+LOG_MODULE_DECLARE(Controller_app, LOG_LEVEL_INF);
+
+/* SWI1 is free with the SoftDevice Controller, EGU1 is not used */
+#define RADIO_NOTIFY_IRQn SWI1_EGU1_IRQn
+#define RADIO_NOTIFY_PRIO 5
+/* the busy window opens this long before the radio ramps up */
+#define RADIO_NOTIFY_DISTANCE MPSL_RADIO_NOTIFICATION_DISTANCE_800US
+#define RADIO_WAITERS 4
+
+#define RADIO_QUIET BIT(0)
+
+static atomic_ptr_t waiters[RADIO_WAITERS];
+static uint32_t radio_events;
+static bool radio_busy;
+static bool radio_ready;
+
+K_EVENT_DEFINE(radio_evt);
+
+static struct radio_stats stats[RADIO_USER_COUNT];
+static struct k_spinlock stats_lock;
+
+/** @brief Active and inactive notifications share the interrupt and alternate
+ *
+ * Nothing in the interrupt tells the two apart. The notification is set
+ * up before the stack starts, so the first one is always the active edge
+ * and the toggle stays in phase.
+ */
+static void radio_notify_isr(const void *arg)
+{
+	ARG_UNUSED(arg);
+
+	radio_busy = !radio_busy;
+	if (radio_busy)
+	{
+		k_event_clear(&radio_evt, RADIO_QUIET);
+		return;
+	}
+
+	radio_events++;
+	k_event_post(&radio_evt, RADIO_QUIET);
+	for (size_t i = 0; i < ARRAY_SIZE(waiters); i++)
+	{
+		struct k_work *work = atomic_ptr_clear(&waiters[i]);
+
+		if (work)
+		{
+			k_work_submit(work);
+		}
+	}
+}
+
+int radio_notify_init(void)
+{
+	radio_busy = false;
+	k_event_post(&radio_evt, RADIO_QUIET);
+
+	IRQ_CONNECT(RADIO_NOTIFY_IRQn, RADIO_NOTIFY_PRIO, radio_notify_isr, NULL, 0);
+	irq_enable(RADIO_NOTIFY_IRQn);
+
+	int32_t err = mpsl_radio_notification_cfg_set(MPSL_RADIO_NOTIFICATION_TYPE_INT_ON_BOTH,
+												  RADIO_NOTIFY_DISTANCE, RADIO_NOTIFY_IRQn);
+	if (err)
+	{
+		LOG_ERR("Radio notification failed (err %d)", err);
+		return -EIO;
+	}
+
+	radio_ready = true;
+	return 0;
+}
+
+int radio_after_event(struct k_work *work)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(waiters); i++)
+	{
+		if ((atomic_ptr_get(&waiters[i]) == work) || atomic_ptr_cas(&waiters[i], NULL, work))
+		{
+			return 0;
+		}
+	}
+	return -ENOMEM;
+}
+
+int radio_wait_quiet(enum radio_user user, k_timeout_t timeout)
+{
+	// before the notification is set up nothing would ever clear the wait
+	if (!radio_ready || (user >= RADIO_USER_COUNT))
+	{
+		return 0;
+	}
+
+	if (k_event_test(&radio_evt, RADIO_QUIET))
+	{
+		k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+		stats[user].clear++;
+		k_spin_unlock(&stats_lock, key);
+		return 0;
+	}
+
+	uint32_t start = k_cycle_get_32();
+	bool quiet = k_event_wait(&radio_evt, RADIO_QUIET, false, timeout);
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+	struct radio_stats *st = &stats[user];
+
+	if (quiet)
+	{
+		st->deferred++;
+		st->us_total += us;
+		st->us_max = MAX(st->us_max, us);
+	}
+	else
+	{
+		st->timeouts++;
+	}
+	k_spin_unlock(&stats_lock, key);
+
+	return quiet ? 0 : -EAGAIN;
+}
+
+uint32_t radio_event_count(void)
+{
+	return radio_events;
+}
+
+void radio_stats_get(enum radio_user user, struct radio_stats *out)
+{
+	if (user >= RADIO_USER_COUNT)
+	{
+		return;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	*out = stats[user];
+	k_spin_unlock(&stats_lock, key);
+}
@@ -0,0 +1,99 @@
+#ifndef DCLK_RADIO
+#define DCLK_RADIO
+
+/**
+ * @file Radio.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Keep other current peaks away from radio events
+ *
+ * The MPSL radio notification fires shortly before the radio goes active
+ * and again when it goes inactive. In between the radio is marked busy.
+ * Buzzer starts and OLED flushes wait for it to go quiet, for a bounded
+ * time, so their inrush does not add to the TX current. Work queued with
+ * radio_after_event() starts in the quiet gap after an event.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/kernel.h>
+
+	/** @brief Loads that wait for the radio */
+	enum radio_user
+	{
+		RADIO_USER_BUZZER,
+		RADIO_USER_OLED,
+		RADIO_USER_COUNT,
+	};
+
+	/** @brief How often and how long a user waited */
+	struct radio_stats
+	{
+		/** calls that found the radio quiet */
+		uint32_t clear;
+		/** calls that had to wait */
+		uint32_t deferred;
+		/** calls that gave up and ran during the event */
+		uint32_t timeouts;
+		/** wait of the deferred calls, summed and worst */
+		uint32_t us_total;
+		uint32_t us_max;
+	};
+
+	/** @brief Enable the radio notifications
+	 *
+	 * Call before bt_enable(), while the radio is idle, so the first
+	 * notification is known to be the active one.
+	 *
+	 * @retval 0 If the operation was successful.
+	 *           Otherwise, a (negative) error code is returned.
+	 */
+	int radio_notify_init(void);
+
+	/** @brief Submit work to the system workqueue after the next radio event
+	 *
+	 * Queuing work that is already waiting is not an error. Nothing is
+	 * submitted while the radio is idle, callers need their own timeout.
+	 *
+	 * @param[in] work work item to submit
+	 *
+	 * @retval 0 If the operation was successful.
+	 * @retval -ENOMEM If all waiter slots are taken.
+	 */
+	int radio_after_event(struct k_work *work);
+
+	/** @brief Wait until the radio is not about to transmit or receive
+	 *
+	 * Returns straight away if the radio is quiet. Called before starting
+	 * a load with a large inrush current.
+	 *
+	 * @param[in] user who is waiting, for the statistics
+	 * @param[in] timeout longest wait, kept below anything visible
+	 *
+	 * @retval 0 If the radio is quiet.
+	 * @retval -EAGAIN If it was still busy at the timeout.
+	 */
+	int radio_wait_quiet(enum radio_user user, k_timeout_t timeout);
+
+	/** @brief Radio events seen since boot */
+	uint32_t radio_event_count(void);
+
+	/** @brief Copy the deferral statistics of a user
+	 *
+	 * @param[in] user user to read
+	 * @param[out] stats filled with the current statistics
+	 */
+	void radio_stats_get(enum radio_user user, struct radio_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_RADIO */
@@ -0,0 +1,440 @@
+/*
+ * Host simulation of the controller clock engine
+ *
+ * Replaces DCLK.c, Interface.c and the nRF only modules on native_sim.
+ * Scripted button traces drive the interface callbacks in main.c and
+ * every display update and notification is recorded on the console.
+ * native_sim runs on virtual time, so a whole game replays in
+ * milliseconds of wall clock.
+ *
+ *   west build -b native_sim _ControllerFirmware -- -DCONF_FILE=sim.conf
+ *   ./build/zephyr/zephyr.exe
+ *
+ * Lines starting with REC are the recording, SIM lines the summary. Each
+ * step is checked against the display update and sync record it should
+ * produce, a FAIL line is printed for every mismatch and the run exits
+ * non-zero.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/bluetooth/uuid.h>
+
+#include "posix_board_if.h"
+
+#include "DCLK.h"
+#include "Interface.h"
+#include "Clock.h"
+#include "Buzzer.h"
+#include "retained.h"
+#include "Trace.h"
+#include "Radio.h"
+#include "Battery.h"
+
+#include <string.h>
+
+/*
+
+
+*/
+/*TRACE*/
+enum sim_btn
+{
+	SIM_PAIR,
+	SIM_USER,
+	SIM_START,
+	SIM_STOP,
+};
+
+struct sim_step
+{
+	uint32_t at; // ms of uptime
+	uint8_t btn;
+	uint8_t evt;
+	/* expected once the step is handled */
+	uint8_t ui_clock; // shown seconds, or SIM_ANY_UI
+	uint8_t ui_state;
+	uint32_t sync; // remaining in the event record, or SIM_ANY / SIM_NO_SYNC
+};
+
+#define SIM_PRESS_MS 80
+#define SIM_TAIL_MS 3000
+
+#define SIM_ANY UINT32_MAX
+#define SIM_NO_SYNC (UINT32_MAX - 1)
+#define SIM_ANY_UI UINT8_MAX
+
+/* A push and release, as the button work items deliver them */
+#define SIM_PRESS(_at, _btn) SIM_EXPECT(_at, _btn, SIM_ANY_UI, 0, SIM_ANY)
+
+/* The push must show _clock and _state and send a record holding _sync */
+#define SIM_EXPECT(_at, _btn, _clock, _state, _sync)      \
+	{(_at), (_btn), 1, (_clock), (_state), (_sync)},       \
+	{(_at) + SIM_PRESS_MS, (_btn), 0, SIM_ANY_UI, 0, SIM_ANY}
+
+/* Countdown beeps on the last 3 s of the 15000, 33500 and 46000 runs */
+#define SIM_BEEPS_COUNTDOWN 9
+
+/* One game: pairing, a run of possessions with stops and restarts, one
+ * shot clock violation, then a broadcast toggle.
+ */
+static const struct sim_step game[] = {
+	{200, SIM_PAIR, BTN_EVT_HOLD, SIM_ANY_UI, 0, SIM_ANY}, // starts pairing
+	SIM_PRESS(1500, SIM_PAIR),							   // ends it
+	SIM_EXPECT(2000, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_EXPECT(5200, SIM_STOP, 7, CLOCK_STOPPED, 6800),
+	SIM_EXPECT(7000, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_EXPECT(8450, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_EXPECT(12999, SIM_STOP, 6, CLOCK_STOPPED, 5451),
+	SIM_EXPECT(13010, SIM_STOP, 6, CLOCK_STOPPED, SIM_NO_SYNC), // already stopped
+	SIM_EXPECT(15000, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_EXPECT(24990, SIM_STOP, 1, CLOCK_STOPPED, 10), // 10 ms before the expiry
+	SIM_EXPECT(27000, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_EXPECT(31500, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_EXPECT(33000, SIM_STOP, 9, CLOCK_STOPPED, 8500),
+	SIM_EXPECT(33500, SIM_START, 10, CLOCK_RUNNING, 10000), // runs out
+	SIM_EXPECT(45000, SIM_USER, 0, CLOCK_EXPIRED, SIM_NO_SYNC),
+	SIM_EXPECT(46000, SIM_START, 10, CLOCK_RUNNING, 10000),
+	SIM_PRESS(52000, SIM_USER), // lands on a tick
+};
+
+/*
+
+
+*/
+/*RECORDING*/
+static struct interface_cb *sim_cb;
+K_SEM_DEFINE(sim_ready, 0, 1);
+
+static struct
+{
+	uint32_t evt_time;
+	bool evt_pending;
+	uint32_t updates;
+	uint32_t latency_max;
+	uint32_t latency_sum;
+	uint32_t latency_cnt;
+	uint32_t tick_time;
+	uint32_t tick_clock;
+	uint32_t jitter_max;
+	uint16_t seq;
+	bool pair_en;
+	bool bcast_en;
+	bool conn_active;
+	uint32_t ui_clock;
+	uint8_t ui_state;
+	struct dclk_sync sync;
+	uint32_t buzz[BUZZER_PATTERN_COUNT];
+	uint32_t fails;
+} rec;
+
+static const char *const sim_btn_name[] = {"pair", "user", "start", "stop"};
+
+static void sim_fail(const char *what, uint32_t got, uint32_t want)
+{
+	rec.fails++;
+	printk("SIM FAIL %u %s %u, expected %u\n", k_uptime_get_32(), what, got, want);
+}
+
+/* dclk_app has the higher priority, it has handled the press by the time
+ * the callback returns.
+ */
+static void sim_check(const struct sim_step *step, uint16_t seq)
+{
+	if (SIM_ANY_UI != step->ui_clock)
+	{
+		if (rec.ui_clock != step->ui_clock)
+		{
+			sim_fail("ui clock", rec.ui_clock, step->ui_clock);
+		}
+		if (rec.ui_state != step->ui_state)
+		{
+			sim_fail("ui state", rec.ui_state, step->ui_state);
+		}
+	}
+
+	if (SIM_NO_SYNC == step->sync)
+	{
+		if (rec.seq != seq)
+		{
+			sim_fail("sync records", rec.seq - seq, 0);
+		}
+	}
+	else if (SIM_ANY != step->sync)
+	{
+		if (rec.seq == seq)
+		{
+			sim_fail("sync records", 0, 1);
+			return;
+		}
+		if (!(rec.sync.flags & DCLK_SYNC_FLAG_EVENT))
+		{
+			sim_fail("sync event flag", 0, 1);
+		}
+		if (rec.sync.state != step->ui_state)
+		{
+			sim_fail("sync state", rec.sync.state, step->ui_state);
+		}
+		if (rec.sync.remaining != step->sync)
+		{
+			sim_fail("sync remaining", rec.sync.remaining, step->sync);
+		}
+	}
+}
+
+static void sim_dispatch(const struct sim_step *step)
+{
+	active_func func[] = {sim_cb->pair, sim_cb->user, sim_cb->start, sim_cb->stop};
+	struct clock_snapshot before, after;
+	uint16_t seq = rec.seq;
+
+	printk("REC %u btn %s %d\n", k_uptime_get_32(), sim_btn_name[step->btn], step->evt);
+
+	clock_snapshot(&before);
+	if (func[step->btn])
+	{
+		func[step->btn](step->evt);
+	}
+	clock_snapshot(&after);
+	sim_check(step, seq);
+
+	// only presses that moved the clock are owed a display update
+	if (before.epoch != after.epoch)
+	{
+		rec.evt_time = before.stamp;
+		rec.evt_pending = true;
+	}
+}
+
+static void sim_run(void)
+{
+	k_sem_take(&sim_ready, K_FOREVER);
+
+	for (size_t i = 0; i < ARRAY_SIZE(game); i++)
+	{
+		k_sleep(K_TIMEOUT_ABS_MS(game[i].at));
+		sim_dispatch(&game[i]);
+	}
+	k_sleep(K_MSEC(SIM_TAIL_MS));
+
+	printk("SIM steps %u updates %u sync %u\n", (unsigned int)ARRAY_SIZE(game),
+		   rec.updates, rec.seq);
+	printk("SIM press-to-update max %u ms avg %u ms\n", rec.latency_max,
+		   rec.latency_cnt ? rec.latency_sum / rec.latency_cnt : 0);
+	printk("SIM tick jitter max %u ms\n", rec.jitter_max);
+
+	if (rec.buzz[BUZZER_COUNTDOWN] != SIM_BEEPS_COUNTDOWN)
+	{
+		sim_fail("countdown beeps", rec.buzz[BUZZER_COUNTDOWN], SIM_BEEPS_COUNTDOWN);
+	}
+	if (rec.buzz[BUZZER_HORN] != 1)
+	{
+		sim_fail("horns", rec.buzz[BUZZER_HORN], 1);
+	}
+	if (rec.buzz[BUZZER_CHIRP] != 1)
+	{
+		sim_fail("chirps", rec.buzz[BUZZER_CHIRP], 1);
+	}
+
+	printk("SIM %s (%u failed)\n", rec.fails ? "FAIL" : "PASS", rec.fails);
+	posix_exit(rec.fails ? 1 : 0);
+}
+
+K_THREAD_DEFINE(sim, 1024, sim_run, NULL, NULL, NULL, 7, 0, 0);
+
+/*
+
+
+*/
+/*INTERFACE STUBS*/
+int interface_init(struct interface_cb *app_cb)
+{
+	sim_cb = app_cb;
+	k_sem_give(&sim_ready);
+	return 0;
+}
+
+int interface_update(uint32_t *clock, uint8_t *state, char *conn_status, uint8_t *battery)
+{
+	uint32_t now = k_uptime_get_32();
+
+	rec.updates++;
+	rec.ui_clock = *clock;
+	rec.ui_state = *state;
+	printk("REC %u ui clock %u state %u status %c\n", now, *clock, *state, *conn_status);
+
+	if (rec.evt_pending)
+	{
+		uint32_t latency = now - rec.evt_time;
+
+		rec.evt_pending = false;
+		rec.latency_sum += latency;
+		rec.latency_cnt++;
+		rec.latency_max = MAX(rec.latency_max, latency);
+		rec.tick_time = 0;
+	}
+	else if ((CLOCK_RUNNING == *state) && (*clock != rec.tick_clock))
+	{
+		// a whole second went by since the previous tick
+		if (rec.tick_time && (rec.tick_clock == *clock + 1))
+		{
+			int32_t dev = (int32_t)(now - rec.tick_time) - 1000;
+			uint32_t jitter = (dev < 0) ? -dev : dev;
+
+			rec.jitter_max = MAX(rec.jitter_max, jitter);
+		}
+		rec.tick_time = now;
+	}
+	rec.tick_clock = *clock;
+
+	return 0;
+}
+
+int interface_off(void)
+{
+	printk("REC %u off\n", k_uptime_get_32());
+	return 0;
+}
+
+static const char *const sim_pattern_name[] = {"countdown", "horn", "chirp"};
+
+/* No retained RAM on the host, every run is a cold boot */
+void trace_init(void)
+{
+}
+
+void trace_event(enum trace_type type, uint16_t arg)
+{
+}
+
+void trace_seal(void)
+{
+}
+
+const uint8_t *trace_report(size_t *len)
+{
+	*len = 0;
+	return NULL;
+}
+
+void trace_print(void)
+{
+}
+
+struct retained_data retained;
+
+bool retained_validate(void)
+{
+	memset(&retained, 0, sizeof(retained));
+	return false;
+}
+
+void retained_update(void)
+{
+}
+
+int radio_notify_init(void)
+{
+	return 0;
+}
+
+void radio_stats_get(enum radio_user user, struct radio_stats *stats)
+{
+	*stats = (struct radio_stats){0};
+}
+
+int battery_init(battery_cb_t cb)
+{
+	return 0;
+}
+
+uint8_t battery_level(void)
+{
+	return 100;
+}
+
+void battery_stats_get(struct battery_stats *stats)
+{
+	*stats = (struct battery_stats){0};
+}
+
+int interface_buzz(enum buzzer_pattern pattern)
+{
+	rec.buzz[pattern]++;
+	printk("REC %u buzz %s\n", k_uptime_get_32(), sim_pattern_name[pattern]);
+	return 0;
+}
+
+/*
+
+
+*/
+/*DCLK STUBS*/
+int dclk_init(struct dclk_cb *callbacks)
+{
+	return 0;
+}
+
+int dclk_pairing(bool enable)
+{
+	rec.pair_en = enable;
+	printk("REC %u pairing %d\n", k_uptime_get_32(), enable);
+	return 0;
+}
+
+int dclk_broadcast(bool enable)
+{
+	rec.bcast_en = enable;
+	printk("REC %u broadcast %d\n", k_uptime_get_32(), enable);
+	return 0;
+}
+
+int dclk_conn_active(bool active)
+{
+	if (active != rec.conn_active)
+	{
+		rec.conn_active = active;
+		printk("REC %u conn_active %d\n", k_uptime_get_32(), active);
+	}
+	return 0;
+}
+
+int dclk_get_status(struct dclk_info *status)
+{
+	*status = (struct dclk_info){
+		.num_conn = 1,
+		.pair_en = rec.pair_en,
+		.bcast_en = rec.bcast_en,
+	};
+	return 0;
+}
+
+int dclk_last_peer(bt_addr_le_t *peer)
+{
+	return -ENOENT;
+}
+
+int dclk_reconnect(const bt_addr_le_t *peer)
+{
+	return -ENOENT;
+}
+
+int dclk_send_state_notify(uint8_t *state)
+{
+	return 0;
+}
+
+int dclk_send_clock_notify(uint32_t *clock)
+{
+	return 0;
+}
+
+int dclk_send_sync_notify(struct dclk_sync *sync)
+{
+	sync->seq = ++rec.seq;
+	rec.sync = *sync;
+	printk("REC %u sync seq %u state %u remaining %u epoch %u flags %x\n",
+		   k_uptime_get_32(), sync->seq, sync->state, sync->remaining,
+		   sync->epoch, sync->flags);
+	return 0;
+}
@@ -0,0 +1,227 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/fatal.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/reboot.h>
+
+#include <string.h>
+
+#include <hal/nrf_power.h>
+
+#include "Trace.h"
+#include "retained.h"
+
+LOG_MODULE_DECLARE(Controller_app, LOG_LEVEL_INF);
+
+#define TRACE_MAGIC 0x44545231 // "DTR1"
+#define TRACE_REPORT_LEN MIN(TRACE_LEN, (TRACE_REPORT_MAX - TRACE_HDR_SIZE) / TRACE_ENTRY_SIZE)
+
+BUILD_ASSERT((TRACE_LEN & (TRACE_LEN - 1)) == 0, "TRACE_LEN must be a power of two");
+
+/*
+
+
+
+*/
+/*RING*/
+/* The tag is the lap the slot was written in and is stored last, so a
+ * slot cut off half way by a reset still carries the previous lap and is
+ * skipped on readout. Slots are cleared to 0xFF at the start of a session.
+ */
+struct trace_slot
+{
+	uint32_t cycles;
+	uint16_t arg;
+	uint8_t type;
+	uint8_t tag;
+};
+
+struct trace_ring
+{
+	uint32_t magic;
+	uint16_t session;
+	uint16_t reset;	 // packed reset reason this session started with
+	uint32_t start;	 // cycle counter at trace_init
+	atomic_t head;	 // events written this session
+	struct trace_slot slot[TRACE_LEN];
+	/* CRC-32 of everything above, only written by trace_seal() */
+	uint32_t crc;
+};
+
+/* Not zeroed at startup, the previous session is still in it */
+static __noinit struct trace_ring ring;
+
+#define TRACE_CRC_OFFSET offsetof(struct trace_ring, crc)
+
+static uint8_t report[TRACE_HDR_SIZE + TRACE_REPORT_LEN * TRACE_ENTRY_SIZE];
+static size_t report_len;
+
+void trace_event(enum trace_type type, uint16_t arg)
+{
+	atomic_val_t i = atomic_inc(&ring.head);
+	struct trace_slot *slot = &ring.slot[i & (TRACE_LEN - 1)];
+
+	slot->cycles = k_cycle_get_32();
+	slot->arg = arg;
+	slot->type = type;
+	compiler_barrier();
+	slot->tag = (uint8_t)(i / TRACE_LEN);
+}
+
+void trace_seal(void)
+{
+	uint32_t crc = crc32_ieee((const uint8_t *)&ring, TRACE_CRC_OFFSET);
+
+	ring.crc = sys_cpu_to_le32(crc);
+}
+
+/*
+
+
+
+*/
+/*READOUT*/
+/* RESETREAS keeps the pin, watchdog, soft reset and lockup bits in 0..3 and
+ * the wake sources from 16 up. A power-on or brown-out reset sets none.
+ */
+static uint16_t reset_pack(uint32_t resetreas)
+{
+	return (resetreas & 0x0F) | ((resetreas >> 12) & 0x1F0);
+}
+
+static bool ring_sealed(void)
+{
+	/* same residue check as retained_validate() */
+	const uint32_t residue = 0x2144df1c;
+
+	return residue == crc32_ieee((const uint8_t *)&ring, TRACE_CRC_OFFSET + sizeof(ring.crc));
+}
+
+static void report_build(uint16_t reset)
+{
+	uint32_t head = atomic_get(&ring.head);
+	uint32_t first = (head > TRACE_REPORT_LEN) ? (head - TRACE_REPORT_LEN) : 0;
+	uint8_t *pos = &report[TRACE_HDR_SIZE];
+	uint8_t count = 0;
+
+	for (uint32_t i = first; i != head; i++)
+	{
+		const struct trace_slot *slot = &ring.slot[i & (TRACE_LEN - 1)];
+
+		if (slot->tag != (uint8_t)(i / TRACE_LEN))
+		{
+			continue;
+		}
+		sys_put_le32(k_cyc_to_ms_floor32(slot->cycles - ring.start), pos);
+		sys_put_le16(slot->arg, pos + 4);
+		pos[6] = slot->type;
+		pos[7] = 0;
+		pos += TRACE_ENTRY_SIZE;
+		count++;
+	}
+
+	sys_put_le16(ring.session, &report[0]);
+	sys_put_le16(reset, &report[2]);
+	report[4] = TRACE_FLAG_VALID | (ring_sealed() ? TRACE_FLAG_SEALED : 0);
+	report[5] = count;
+	sys_put_le16(0, &report[6]);
+	report_len = pos - report;
+}
+
+void trace_init(void)
+{
+	uint32_t resetreas = nrf_power_resetreas_get(NRF_POWER);
+	uint16_t reset = reset_pack(resetreas);
+	uint16_t session = 0;
+
+	// sticky until cleared, the next boot must only see its own cause
+	nrf_power_resetreas_clear(NRF_POWER, resetreas);
+
+	if (TRACE_MAGIC == ring.magic)
+	{
+		report_build(reset);
+		session = ring.session + 1;
+	}
+	else
+	{
+		memset(report, 0, TRACE_HDR_SIZE);
+		sys_put_le16(reset, &report[2]);
+		report_len = TRACE_HDR_SIZE;
+	}
+
+	memset(ring.slot, 0xFF, sizeof(ring.slot));
+	ring.magic = TRACE_MAGIC;
+	ring.session = session;
+	ring.reset = reset;
+	ring.start = k_cycle_get_32();
+	ring.crc = 0;
+	atomic_set(&ring.head, 0);
+
+	// resets keep RAM anyway, System OFF only keeps the retained sections
+	(void)ram_range_retain(&ring, sizeof(ring), true);
+
+	trace_event(TRACE_BOOT, reset);
+}
+
+const uint8_t *trace_report(size_t *len)
+{
+	*len = report_len;
+	return report;
+}
+
+static const char *const trace_type_name[] = {
+	[TRACE_BOOT] = "boot",
+	[TRACE_BUTTON] = "button",
+	[TRACE_STATE_RUNNING] = "running",
+	[TRACE_STATE_STOPPED] = "stopped",
+	[TRACE_STATE_EXPIRED] = "expired",
+	[TRACE_CONN] = "conn",
+	[TRACE_DISCONN] = "disconn",
+	[TRACE_NOTIFY_ERR] = "notify err",
+	[TRACE_FATAL] = "fatal",
+	[TRACE_POWEROFF] = "poweroff",
+};
+
+void trace_print(void)
+{
+	if (!(report[4] & TRACE_FLAG_VALID))
+	{
+		printk("TRACE none, reset 0x%03x\n", sys_get_le16(&report[2]));
+		return;
+	}
+
+	printk("TRACE session %u reset 0x%03x %s, %u events\n", sys_get_le16(&report[0]),
+		   sys_get_le16(&report[2]), (report[4] & TRACE_FLAG_SEALED) ? "sealed" : "cut off",
+		   report[5]);
+
+	for (const uint8_t *pos = &report[TRACE_HDR_SIZE]; pos < &report[report_len];
+		 pos += TRACE_ENTRY_SIZE)
+	{
+		uint8_t type = pos[6];
+
+		printk("TRACE %8u ms %-10s %u\n", sys_get_le32(pos),
+			   (type < ARRAY_SIZE(trace_type_name) && trace_type_name[type]) ? trace_type_name[type]
+																			  : "?",
+			   sys_get_le16(pos + 4));
+	}
+}
+
+/*
+
+
+
+*/
+/*FATAL ERRORS*/
+/* Replaces the default handler so the trace is sealed before the reboot */
+void k_sys_fatal_error_handler(unsigned int reason, const z_arch_esf_t *esf)
+{
+	ARG_UNUSED(esf);
+
+	trace_event(TRACE_FATAL, reason);
+	trace_seal();
+	LOG_PANIC();
+	sys_reboot(SYS_REBOOT_COLD);
+}
@@ -0,0 +1,101 @@
+#ifndef DCLK_TRACE
+#define DCLK_TRACE
+
+/**
+ * @file Trace.h
+ * @defgroup DCLK_refController
+ * @{
+ * @brief Event trace that survives resets and System OFF
+ *
+ * Events go into a ring in retained RAM. After a reset the ring of the
+ * previous session is copied out, so the events that led up to a crash
+ * or brown-out can be read on the console or over GATT.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <zephyr/sys/util.h>
+
+/** Events kept, power of two */
+#define TRACE_LEN 64
+
+/** Report header, then TRACE_ENTRY_SIZE bytes per event, oldest first */
+#define TRACE_HDR_SIZE 8
+#define TRACE_ENTRY_SIZE 8
+/** Largest report, fits in one ATT attribute */
+#define TRACE_REPORT_MAX 512
+
+/** Report flags */
+#define TRACE_FLAG_VALID BIT(0)  // a previous session was found
+#define TRACE_FLAG_SEALED BIT(1) // it ended in poweroff or a fatal error
+
+	enum trace_type
+	{
+		/** session start, arg is the packed reset reason */
+		TRACE_BOOT = 1,
+		/** debounced button edge, arg is pin << 8 | level */
+		TRACE_BUTTON,
+		/** clock state change, arg is the remaining time in ms */
+		TRACE_STATE_RUNNING,
+		TRACE_STATE_STOPPED,
+		TRACE_STATE_EXPIRED,
+		/** arg is the HCI error */
+		TRACE_CONN,
+		/** arg is the HCI reason */
+		TRACE_DISCONN,
+		/** arg is the negative error code */
+		TRACE_NOTIFY_ERR,
+		/** arg is the fatal error reason */
+		TRACE_FATAL,
+		TRACE_POWEROFF,
+	};
+
+	/** @brief Take over the ring of the previous session and start a new one
+	 *
+	 * Must run before any other trace call, first thing in main().
+	 */
+	void trace_init(void);
+
+	/** @brief Append an event. Safe to call from any context.
+	 *
+	 * @param[in] type event type
+	 * @param[in] arg event argument, see enum trace_type
+	 */
+	void trace_event(enum trace_type type, uint16_t arg);
+
+	/** @brief Add a CRC over the ring so the next boot knows it is complete
+	 *
+	 * Call on the way down: poweroff or a fatal error. A session that was
+	 * cut off by a brown-out or the watchdog is read back unsealed.
+	 */
+	void trace_seal(void);
+
+	/** @brief Previous session in wire format
+	 *
+	 * Header: le16 session, le16 reset reason, u8 flags, u8 count, le16
+	 * reserved. Each event: le32 ms since that session started, le16 arg,
+	 * u8 type, u8 reserved.
+	 *
+	 * @param[out] len report length in bytes
+	 *
+	 * @retval report, valid until the next reset
+	 */
+	const uint8_t *trace_report(size_t *len);
+
+	/** @brief Print the previous session on the console */
+	void trace_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_TRACE */
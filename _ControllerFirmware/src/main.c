@@ -23,9 +23,18 @@
 
 #include "DCLK.h"
 #include "Interface.h"
-
+#include "Clock.h"
+#include "Buzzer.h"
+#include "retained.h"
+#include "Boot.h"
+#include "Trace.h"
+#include "Radio.h"
+#include "Battery.h"
+
+#ifndef CONFIG_BOARD_NATIVE_SIM
 #include <soc.h>
 #include <hal/nrf_gpio.h>
+#endif
 
 LOG_MODULE_REGISTER(Controller_app, LOG_LEVEL_INF);
 
@@ -36,20 +45,48 @@ LOG_MODULE_REGISTER(Controller_app, LOG_LEVEL_INF);
 #define GO_SLEEP_LONG 30000
 #define CLOCK_RESET_VALUE 10000
 
-#define SYNC_INTERVAL 500
+#define CLOCK_TICK_MS 1000
+#define CLOCK_RESYNC_MS 5000
+#define CLOCK_BEEP_FROM 3 // countdown beeps on the last seconds
+
+/* The timer expires in ISR context, power off blocks on the OLED bus */
+static void poweroff(struct k_work *work);
+K_WORK_DEFINE(poweroff_work, poweroff);
 
-static void poweroff(void);
-K_TIMER_DEFINE(sleep_timer, poweroff, NULL);
+static void sleep_expire(struct k_timer *timer_id)
+{
+	k_work_submit(&poweroff_work);
+}
+K_TIMER_DEFINE(sleep_timer, sleep_expire, NULL);
 /*
 
 
 */
 /*SHOT CLOCK*/
+/* d_timer only delivers the expiry; the clock itself lives in Clock.c */
 struct k_timer d_timer;
-static uint8_t clock_state = 0; // shot clock state
-static uint32_t clock_value = 0;
 
 // Helper QUEUES
+/* Wakes the clock engine on a state change. Binary so that several events
+ * arriving before the engine runs are coalesced into one update.
+ */
+K_SEM_DEFINE(clock_evt, 0, 1);
+
+/* Press-to-notify latency instrumentation */
+static uint32_t evt_cycles;
+static uint32_t evt_latency_max_us;
+
+static void clock_signal(void)
+{
+	evt_cycles = k_cycle_get_32();
+	k_sem_give(&clock_evt);
+}
+
+/* Redraw for the battery icon, rare enough to ride on the clock wakeup */
+static void battery_changed(uint8_t level)
+{
+	k_sem_give(&clock_evt);
+}
 
 /*
 
@@ -59,19 +96,48 @@ static uint32_t clock_value = 0;
 /*DCLK CALLBACKS*/
 static uint32_t DCLK_clock_cb(void)
 {
-	// d_clock = k_timer_remaining_get(&d_timer);
-	return k_timer_remaining_get(&d_timer);
-	;
+	struct clock_snapshot snap;
+
+	clock_snapshot(&snap);
+	return snap.remaining;
 }
 
 static uint8_t DCKL_state_cb(void)
 {
-	return clock_state;
+	struct clock_snapshot snap;
+
+	clock_snapshot(&snap);
+	return snap.state;
+}
+
+static void DCLK_sync_fill(struct dclk_sync *sync, const struct clock_snapshot *snap)
+{
+	sync->state = snap->state;
+	sync->flags = 0;
+	sync->epoch = snap->epoch;
+	sync->stamp = snap->stamp;
+	sync->remaining = snap->remaining;
+	sync->deadline = snap->deadline;
+}
+
+static void DCLK_sync_cb(struct dclk_sync *sync)
+{
+	struct clock_snapshot snap;
+
+	clock_snapshot(&snap);
+	DCLK_sync_fill(sync, &snap);
+}
+
+static void DCLK_status_cb(void)
+{
+	clock_signal();
 }
 
 static struct dclk_cb DCLK_callbacks = {
 	.clock_cb = DCLK_clock_cb,
 	.state_cb = DCKL_state_cb,
+	.sync_cb = DCLK_sync_cb,
+	.status_cb = DCLK_status_cb,
 };
 
 /*
@@ -81,12 +147,17 @@ static struct dclk_cb DCLK_callbacks = {
 /*Button Callbacks*/
 static uint8_t pair_cb(uint8_t evt)
 {
-	if (1 == evt)
+	dclk_info status;
+
+	dclk_get_status(&status);
+	// pairing wipes the bonds, so it takes a hold; a later push ends it
+	if ((BTN_EVT_HOLD == evt) && !status.pair_en)
 	{
 		LOG_INF("pairing : %d", evt);
 		dclk_pairing(true);
+		interface_buzz(BUZZER_CHIRP);
 	}
-	else if (0 == evt)
+	else if ((BTN_EVT_PUSH == evt) && status.pair_en)
 	{
 		LOG_INF("stop pairing : %d", evt);
 		dclk_pairing(false);
@@ -95,9 +166,19 @@ static uint8_t pair_cb(uint8_t evt)
 
 	return 0;
 }
+static bool ui_broadcast;
+
 static uint8_t user_cb(uint8_t evt)
 {
 	LOG_INF("user : %d", evt);
+	if (1 == evt)
+	{
+		ui_broadcast = !ui_broadcast;
+		if (dclk_broadcast(ui_broadcast))
+		{
+			ui_broadcast = false;
+		}
+	}
 	return 0;
 }
 
@@ -107,9 +188,9 @@ static uint8_t start_cb(uint8_t evt)
 
 	if (1 == evt)
 	{
-		clock_state = 0;
-
+		clock_start(CLOCK_RESET_VALUE);
 		k_timer_start(&d_timer, K_MSEC(CLOCK_RESET_VALUE), K_NO_WAIT);
+		clock_signal();
 	}
 
 	k_timer_stop(&sleep_timer);
@@ -119,12 +200,15 @@ static uint8_t start_cb(uint8_t evt)
 
 static uint8_t stop_cb(uint8_t evt)
 {
-	LOG_INF("stop : %d", clock_value);
+	LOG_INF("stop : %d", evt);
 	if (1 == evt)
 	{
-		clock_value = k_timer_remaining_get(&d_timer);
-		k_timer_stop(&d_timer);
-		clock_state = 1;
+		// the model holds the remaining time; a racing expiry is ignored
+		if (clock_stop())
+		{
+			k_timer_stop(&d_timer);
+			clock_signal();
+		}
 	}
 
 	return 0;
@@ -140,12 +224,73 @@ static struct interface_cb interface_callbacks =
 
 static void d_clock_expire(struct k_timer *timer_id)
 {
-	clock_state = 2;
+	if (!clock_expire())
+	{
+		return;
+	}
 	k_timer_start(&sleep_timer, K_MSEC(GO_SLEEP_SHORT), K_NO_WAIT);
+	clock_signal();
+}
 
+/** @brief Time until the displayed second changes
+ *
+ * The display shows whole seconds rounded up, so the next change happens
+ * when the remaining time crosses a multiple of CLOCK_TICK_MS.
+ */
+static k_timeout_t clock_next_tick(void)
+{
+	struct clock_snapshot snap;
+
+	clock_snapshot(&snap);
+	if (CLOCK_RUNNING != snap.state)
+	{
+		return K_FOREVER;
+	}
+
+	uint32_t remaining = snap.remaining;
+	if (0 == remaining)
+	{
+		return K_FOREVER;
+	}
+
+	uint32_t to_tick = remaining % CLOCK_TICK_MS;
+	if (0 == to_tick)
+	{
+		to_tick = CLOCK_TICK_MS;
+	}
+
+	return K_MSEC(to_tick);
+}
+
+static void clock_latency_update(void)
+{
+	uint32_t cycles = evt_cycles;
+
+	if (0 == cycles)
+	{
+		return;
+	}
+	evt_cycles = 0;
+
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - cycles);
+	if (us > evt_latency_max_us)
+	{
+		evt_latency_max_us = us;
+		LOG_INF("press-to-notify max = %d us", evt_latency_max_us);
+	}
 }
 
-/** @brief Runs the shot clock, notifies DCLK, and updates display */
+/* Set when this boot is a wake from System OFF with a saved clock */
+static bool wake_resumed;
+static bool wake_notify_pending;
+
+/** @brief Runs the shot clock, notifies DCLK, and updates display
+ *
+ * Sleeps until either a state change is signalled or the displayed
+ * second is about to change, then sends one coalesced update. The sync
+ * record only goes out on events and every CLOCK_RESYNC_MS; displays
+ * count down locally in between.
+ */
 void dclk_app(void)
 {
 
@@ -153,22 +298,44 @@ void dclk_app(void)
 	uint8_t d_state = 0;
 	dclk_info conn_status;
 	char dis_status;
+	struct dclk_sync d_sync;
+	struct clock_snapshot snap;
+	bool sync_due = true;
+	uint32_t sync_time = 0;
+	uint32_t last_clock = 0;
+	uint8_t last_state = CLOCK_RUNNING;
+	uint16_t last_epoch = 0;
 
 	k_timer_init(&d_timer, d_clock_expire, NULL);
 
 	while (1)
 	{
 
-		d_state = clock_state;
+		// one snapshot feeds the notifies and the OLED so they always agree
+		clock_snapshot(&snap);
+		d_state = snap.state;
+		d_clock = ROUND_UP(snap.remaining, 1000) / 1000;
 
-		if (1 != d_state)
+		// buzzer follows clock events, redraws never trigger it
+		if ((CLOCK_EXPIRED == d_state) && (CLOCK_EXPIRED != last_state))
 		{
-			d_clock = ROUND_UP(k_timer_remaining_get(&d_timer), 1000) / 1000;
+			interface_buzz(BUZZER_HORN);
 		}
-		else
+		else if ((CLOCK_RUNNING == d_state) && (d_clock != last_clock) &&
+				 (d_clock > 0) && (d_clock <= CLOCK_BEEP_FROM))
 		{
-			d_clock = ROUND_UP(clock_value, 1000) / 1000;
+			interface_buzz(BUZZER_COUNTDOWN);
 		}
+		if (snap.epoch != last_epoch)
+		{
+			trace_event(TRACE_STATE_RUNNING + snap.state, MIN(snap.remaining, UINT16_MAX));
+		}
+		last_clock = d_clock;
+		last_state = d_state;
+		last_epoch = snap.epoch;
+
+		// the model boots running with nothing left, that is idle too
+		dclk_conn_active((CLOCK_RUNNING == d_state) && (snap.remaining > 0));
 		dclk_get_status(&conn_status);
 
 		if (conn_status.pair_en)
@@ -177,31 +344,204 @@ void dclk_app(void)
 		}
 		else
 		{
-			sprintf(&dis_status, "%d", conn_status.num_conn);
+			dis_status = '0' + MIN(conn_status.num_conn, 9);
+		}
+
+		if (sync_due || (k_uptime_get_32() - sync_time) >= CLOCK_RESYNC_MS)
+		{
+			DCLK_sync_fill(&d_sync, &snap);
+			if (sync_due)
+			{
+				d_sync.flags |= DCLK_SYNC_FLAG_EVENT;
+			}
+			dclk_send_sync_notify(&d_sync);
+			sync_time = d_sync.stamp;
+		}
+		// the per-second characteristics are only for displays without the
+		// sync record, and only follow events like it
+		if (sync_due)
+		{
+			dclk_send_clock_notify(&d_clock);
+			dclk_send_state_notify(&d_state);
+		}
+
+		clock_latency_update();
+
+		if (wake_notify_pending && conn_status.notify_sent)
+		{
+			// uptime starts at the wake reset, so this is wake to first notify
+			wake_notify_pending = false;
+			LOG_INF("wake-to-first-notify = %d ms", k_uptime_get_32());
 		}
 
-		dclk_send_clock_notify(&d_clock);
-		dclk_send_state_notify(&d_state);
+		uint8_t battery = battery_level();
 
-		interface_update(&d_clock, &d_state, &dis_status);
+		interface_update(&d_clock, &d_state, &dis_status, &battery);
 
-		k_sleep(K_MSEC(SYNC_INTERVAL));
+		sync_due = (0 == k_sem_take(&clock_evt, clock_next_tick()));
 	}
 	return;
 }
 
+/*
+
+
+*/
+/*RETAINED STATE*/
+/** @brief Restore the clock saved by poweroff()
+ *
+ * Runs before the interface and the radio so the first frame and the
+ * first notification already carry the old clock.
+ */
+static void state_resume(void)
+{
+	bool valid = retained_validate();
+
+	retained.boots++;
+	wake_resumed = valid && retained.clock_valid;
+	if (wake_resumed)
+	{
+		clock_restore(retained.clock_state, retained.clock_remaining, retained.clock_epoch);
+		wake_notify_pending = true;
+		LOG_INF("Resumed clock state %d remaining %d", retained.clock_state,
+				retained.clock_remaining);
+	}
+	// consumed, a cold reset must not bring it back
+	retained.clock_valid = 0;
+	retained_update();
+}
+
+/** @brief Bring back the link and UI state once the radio is up */
+static void state_resume_link(void)
+{
+	if (!wake_resumed)
+	{
+		return;
+	}
+
+	if (retained.peer_valid && (0 == dclk_reconnect(&retained.peer)))
+	{
+		LOG_INF("Reconnecting last display");
+	}
+	if (retained.ui_broadcast)
+	{
+		ui_broadcast = (0 == dclk_broadcast(true));
+	}
+}
+
+static void state_save(void)
+{
+	struct clock_snapshot snap;
+
+	clock_snapshot(&snap);
+	retained.clock_state = snap.state;
+	retained.clock_remaining = snap.remaining;
+	retained.clock_epoch = snap.epoch;
+	retained.clock_valid = 1;
+	retained.ui_broadcast = ui_broadcast;
+	retained.peer_valid = (0 == dclk_last_peer(&retained.peer));
+	retained.off_count++;
+	retained_update();
+}
+
+/*
+
+
+*/
+/*THREAD STATS*/
+#ifdef CONFIG_DCLK_THREAD_STATS
+#define THREAD_STATS_MS 10000
+
+static void thread_stats_print(const struct k_thread *thread, void *user_data)
+{
+	const k_thread_runtime_stats_t *all = user_data;
+	k_thread_runtime_stats_t stats;
+
+	if (k_thread_runtime_stats_get((k_tid_t)thread, &stats) || (0 == all->execution_cycles))
+	{
+		return;
+	}
+
+	LOG_INF("%-12s %3d.%d%%", k_thread_name_get((k_tid_t)thread),
+			(int)(stats.execution_cycles * 100 / all->execution_cycles),
+			(int)(stats.execution_cycles * 1000 / all->execution_cycles % 10));
+}
+
+static void thread_stats_dump(struct k_work *work)
+{
+	k_thread_runtime_stats_t all;
+
+	if (0 == k_thread_runtime_stats_all_get(&all))
+	{
+		k_thread_foreach(thread_stats_print, &all);
+	}
+
+	static const char *const radio_user_name[RADIO_USER_COUNT] = {"buzzer", "oled"};
+
+	for (int user = 0; user < RADIO_USER_COUNT; user++)
+	{
+		struct radio_stats radio;
+
+		radio_stats_get(user, &radio);
+		LOG_INF("%-6s clear %d, deferred %d (avg %d us, max %d us), timeouts %d",
+				radio_user_name[user], radio.clear, radio.deferred,
+				radio.deferred ? radio.us_total / radio.deferred : 0, radio.us_max,
+				radio.timeouts);
+	}
+
+	struct battery_stats batt;
+
+	battery_stats_get(&batt);
+	LOG_INF("battery %d mV, %d samples (%d after radio, %d timeout), %d us last, %d us max",
+			batt.mv, batt.samples, batt.after_radio, batt.on_timeout, batt.us_last, batt.us_max);
+	k_work_schedule(k_work_delayable_from_work(work), K_MSEC(THREAD_STATS_MS));
+}
+
+K_WORK_DELAYABLE_DEFINE(thread_stats_work, thread_stats_dump);
+#endif
+
+/** @brief Arm every button as a System OFF wake source
+ *
+ * Called just before power off so the SENSE setting does not fight the
+ * GPIO driver's own edge detection while running.
+ */
 void power_manage_init(void)
 {
-	nrf_gpio_cfg_input(NRF_DT_GPIOS_TO_PSEL(DT_NODELABEL(button2), gpios),
-					   NRF_GPIO_PIN_PULLUP);
-	nrf_gpio_cfg_sense_set(NRF_DT_GPIOS_TO_PSEL(DT_NODELABEL(button2), gpios),
-						   NRF_GPIO_PIN_SENSE_LOW);
+#ifndef CONFIG_BOARD_NATIVE_SIM
+	static const uint32_t wake_pins[] = {
+		NRF_DT_GPIOS_TO_PSEL(DT_NODELABEL(button0), gpios),
+		NRF_DT_GPIOS_TO_PSEL(DT_NODELABEL(button1), gpios),
+		NRF_DT_GPIOS_TO_PSEL(DT_NODELABEL(button2), gpios),
+		NRF_DT_GPIOS_TO_PSEL(DT_NODELABEL(button3), gpios),
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(wake_pins); i++)
+	{
+		nrf_gpio_cfg_input(wake_pins[i], NRF_GPIO_PIN_PULLUP);
+		nrf_gpio_cfg_sense_set(wake_pins[i], NRF_GPIO_PIN_SENSE_LOW);
+	}
+#endif
 }
 int main(void)
 {
 	int err;
 
+	trace_init();
 	LOG_INF("Starting DCLK Controller \n");
+	boot_mark(BOOT_MAIN);
+
+	state_resume();
+
+	// the radio is still idle, so the first notification is the active edge
+	int radio_err = radio_notify_init();
+
+	// the radio comes up in the background while the OLED is initialized
+	err = dclk_init(&DCLK_callbacks);
+	if (err)
+	{
+		LOG_ERR("Failed to init LBS (err:%d)\n", err);
+		return 0;
+	}
 
 	err = interface_init(&interface_callbacks);
 	if (err)
@@ -210,18 +550,32 @@ int main(void)
 		return 0;
 	}
 
-	err = dclk_init(&DCLK_callbacks);
+	// the battery is sampled in the gap after a radio event
+	err = radio_err;
+	if (!err)
+	{
+		err = battery_init(battery_changed);
+	}
 	if (err)
 	{
-		LOG_ERR("Failed to init LBS (err:%d)\n", err);
-		return 0;
+		LOG_ERR("Battery init failed (err %d)\n", err);
 	}
 
 	LOG_INF("Initialized \n");
 
-	power_manage_init();
+	// a wake from System OFF is routine, anything else may be a crash
+	if (!wake_resumed)
+	{
+		trace_print();
+	}
+
+	state_resume_link();
 	k_timer_start(&sleep_timer,K_MSEC(GO_SLEEP_LONG),K_NO_WAIT);
 
+#ifdef CONFIG_DCLK_THREAD_STATS
+	k_work_schedule(&thread_stats_work, K_MSEC(THREAD_STATS_MS));
+#endif
+
 	while (1)
 	{
 		k_sleep(K_FOREVER);
@@ -232,12 +586,16 @@ int main(void)
 // Start app thread
 K_THREAD_DEFINE(app, 1024, dclk_app, NULL, NULL, NULL, 5, 0, 0);
 
-void poweroff(void)
+static void poweroff(struct k_work *work)
 {
 	LOG_INF("SLEEP TIMER EXPIRED");
 	// k_thread_suspend(&app);
 	LOG_INF("POWER OFF");
+	state_save();
+	trace_event(TRACE_POWEROFF, 0);
+	trace_seal();
 	interface_off();
+	power_manage_init();
 
 	sys_poweroff();
 }
@@ -64,9 +64,9 @@
  *
  * @param enable true to enable retention, false to clear retention
  */
-static int ram_range_retain(const void *ptr,
-			    size_t len,
-			    bool enable)
+int ram_range_retain(const void *ptr,
+		     size_t len,
+		     bool enable)
 {
 	uintptr_t addr = (uintptr_t)ptr;
 	uintptr_t addr_end = addr + len;
@@ -9,6 +9,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+
+#include <zephyr/bluetooth/addr.h>
 
 /* Example of validatable retained data. */
 struct retained_data {
@@ -28,6 +31,24 @@ struct retained_data {
 	/* Number of times the application has gone into system off. */
 	uint32_t off_count;
 
+	/* Shot clock when the controller went into system off, valid
+	 * until the next boot has restored it.
+	 */
+	uint32_t clock_remaining;
+	uint16_t clock_epoch;
+	uint8_t clock_state;
+	uint8_t clock_valid;
+
+	/* Broadcast toggle from the user button. */
+	uint8_t ui_broadcast;
+
+	/* Display that connected last, advertised to first on wake.
+	 * The GATT handles live on the display, which keeps its own
+	 * cache per bond.
+	 */
+	uint8_t peer_valid;
+	bt_addr_le_t peer;
+
 	/* CRC used to validate the retained data.  This must be
 	 * stored little-endian, and covers everything up to but not
 	 * including this field.
@@ -52,4 +73,11 @@ bool retained_validate(void);
  */
 void retained_update(void);
 
+/* Set or clear RAM retention in SYSTEM_OFF for another object, such as
+ * the event trace in Trace.c.
+ *
+ * @return 0 on success, -EINVAL if the range is not in SRAM.
+ */
+int ram_range_retain(const void *ptr, size_t len, bool enable);
+
 #endif /* RETAINED_H_ */
\ No newline at end of file
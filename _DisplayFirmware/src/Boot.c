@@ -0,0 +1,41 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+
+#include "Boot.h"
+
+LOG_MODULE_DECLARE(Display_app, LOG_LEVEL_INF);
+
+static const char *const boot_phase_name[BOOT_PHASE_COUNT] = {
+	[BOOT_MAIN] = "main",
+	[BOOT_STRIP] = "strip",
+	[BOOT_BT_READY] = "bt ready",
+	[BOOT_SETTINGS] = "settings",
+	[BOOT_SCAN] = "scanning",
+	[BOOT_CONN] = "connected",
+	[BOOT_SUBSCRIBED] = "subscribed",
+	[BOOT_LIVE] = "live clock",
+};
+
+static uint32_t boot_us[BOOT_PHASE_COUNT];
+static atomic_t boot_done = ATOMIC_INIT(0);
+
+void boot_mark(enum boot_phase phase)
+{
+	if ((phase >= BOOT_PHASE_COUNT) || atomic_test_and_set_bit(&boot_done, phase))
+	{
+		return;
+	}
+
+	boot_us[phase] = k_cyc_to_us_floor32(k_cycle_get_32());
+	LOG_INF("boot %s at %d us", boot_phase_name[phase], boot_us[phase]);
+}
+
+uint32_t boot_time_us(enum boot_phase phase)
+{
+	if ((phase >= BOOT_PHASE_COUNT) || !atomic_test_bit(&boot_done, phase))
+	{
+		return 0;
+	}
+	return boot_us[phase];
+}
@@ -2,6 +2,8 @@
 
 #include <zephyr/types.h>
 #include <stddef.h>
+#include <string.h>
+#include <zephyr/kernel.h>
 #include <zephyr/sys/util.h>
 
 #include <zephyr/bluetooth/bluetooth.h>
@@ -9,6 +11,7 @@
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/crypto.h>
 #include <zephyr/sys/byteorder.h>
 #include <bluetooth/gatt_dm.h>
 
@@ -17,12 +20,31 @@
 #include <zephyr/logging/log.h>
 
 #include "DCLK_client.h"
+#include "Boot.h"
 
 // static unsigned int display_passkey = 123456;
 
 static struct bt_conn *DCLK_C_conn;
 struct dclk_client_t DCLK_client;
 
+/* Handles of the bonded controller, kept in settings so a reconnect can
+ * subscribe straight after encryption instead of running discovery.
+ */
+struct dclk_cache
+{
+	bt_addr_le_t addr;
+	uint8_t db_hash[16];
+	struct dclk_client_handles handles;
+};
+
+static struct dclk_cache dclk_cache;
+static bool dclk_cache_valid;
+
+/* Reconnect timing */
+static uint32_t link_lost_time;
+static uint32_t link_up_time;
+static bool first_frame_pending;
+
 #define BT_UUID_DCLK BT_UUID_DECLARE_128(BT_UUID_DCLK_VAL)
 #define BT_UUID_DCLK_VAL BT_UUID_128_ENCODE(0x00001553, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
 
@@ -34,13 +56,492 @@ struct bt_conn_le_create_param *create_params =
 // #define LOG_MODULE_NAME DCLK_CLIENT
 LOG_MODULE_DECLARE(Display_app, LOG_LEVEL_DBG);
 
+/* log the average sync latency every this many records */
+#define DCLK_LATENCY_REPORT 64
+
 enum
 {
 	DCLK_INITIALIZED,
 	DCLK_CLOCK_NOTIF_ENABLED,
-	DCLK_STATE_NOTIF_ENABLED
+	DCLK_STATE_NOTIF_ENABLED,
+	DCLK_SYNC_NOTIF_ENABLED,
+	DCLK_SYNC_VALID,
+	DCLK_SEQ_VALID,
+	DCLK_BCAST_FOLLOW
+};
+
+#define DCLK_BCAST_FALLBACK_MS 5000
+
+void start_auto_connection(void);
+void stop_auto_connection(void);
+static void bcast_follow(struct bt_conn *conn);
+static int scan_filters_set(void);
+static void gatt_discover(struct bt_conn *conn);
+static void scan_found(const char *how);
+
+/*
+
+
+
+
+*/
+/*LOCAL CLOCK*/
+
+static uint32_t sync_remaining(const struct dclk_sync *sync, uint32_t now)
+{
+	if (0 != sync->state)
+	{
+		return sync->remaining;
+	}
+
+	int32_t remaining = (int32_t)(sync->deadline - now);
+
+	return (remaining > 0) ? remaining : 0;
+}
+
+static uint8_t on_sync_received(const uint8_t *frame, uint16_t length)
+{
+	struct dclk_sync *sync = &DCLK_client.sync;
+
+	if (length < DCLK_SYNC_LEN)
+	{
+		LOG_WRN("Short sync record (%d)", length);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	uint16_t seq = dclk_sync_seq(frame);
+
+	/* drop repeats and records overtaken by a newer one */
+	if (atomic_test_and_set_bit(&DCLK_client.conn_state, DCLK_SEQ_VALID) &&
+		(int16_t)(seq - sync->seq) <= 0)
+	{
+		LOG_DBG("Stale sync record %d (last %d)", seq, sync->seq);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	uint32_t now = k_uptime_get_32();
+	uint32_t stamp = dclk_sync_stamp(frame);
+	uint32_t offset = now - stamp;
+
+	/* A newer record with an older stamp comes from a restarted
+	 * controller, its uptime is a new time base.
+	 */
+	if (atomic_test_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID) &&
+		(int32_t)(stamp - DCLK_client.stamp_last) < 0)
+	{
+		LOG_INF("Controller restarted, new time base");
+		atomic_clear_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID);
+	}
+	DCLK_client.stamp_last = stamp;
+
+	/* notify-to-receive time above the fastest record seen so far */
+	if (atomic_test_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID))
+	{
+		int32_t latency = MAX((int32_t)(offset - DCLK_client.offset), 0);
+
+		if (latency > (int32_t)DCLK_client.latency_max)
+		{
+			DCLK_client.latency_max = latency;
+			LOG_INF("Sync latency max = %d ms", latency);
+		}
+		DCLK_client.latency_sum += latency;
+		if (0 == (++DCLK_client.latency_cnt % DCLK_LATENCY_REPORT))
+		{
+			LOG_INF("Sync latency avg %d ms, max %d ms over %d records",
+					DCLK_client.latency_sum / DCLK_client.latency_cnt, DCLK_client.latency_max,
+					DCLK_client.latency_cnt);
+		}
+	}
+
+	/* The smallest offset seen has the least transport delay in it.
+	 * Let it creep up slowly so crystal drift is still followed.
+	 */
+	if (!atomic_test_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID) ||
+		(int32_t)(offset - DCLK_client.offset) < 0)
+	{
+		DCLK_client.offset = offset;
+	}
+	else
+	{
+		DCLK_client.offset += (offset - DCLK_client.offset) / 8;
+	}
+
+	// connected or following the broadcast, whichever comes first
+	boot_mark(BOOT_LIVE);
+	if (first_frame_pending)
+	{
+		first_frame_pending = false;
+		LOG_INF("First frame %d ms after connect, %d ms after link loss",
+				now - link_up_time, now - link_lost_time);
+	}
+
+	uint8_t state = dclk_sync_state(frame);
+	bool state_changed = !atomic_test_and_set_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID) ||
+						 (sync->state != state);
+
+	sync->seq = seq;
+	sync->state = state;
+	sync->flags = dclk_sync_flags(frame);
+	sync->epoch = dclk_sync_epoch(frame);
+	sync->remaining = dclk_sync_clock(frame);
+	sync->stamp = stamp + DCLK_client.offset;
+	sync->deadline = dclk_sync_deadline(frame) + DCLK_client.offset;
+
+	if (DCLK_client.cb.received_epoch)
+	{
+		DCLK_client.cb.received_epoch(sync->epoch);
+	}
+
+	if (state_changed && DCLK_client.cb.received_state)
+	{
+		DCLK_client.cb.received_state(sync->state);
+	}
+
+	// the display counts down on its own between records
+	if (DCLK_client.cb.received_clock)
+	{
+		DCLK_client.cb.received_clock(sync_remaining(sync, k_uptime_get_32()));
+	}
+
+	if ((sync->flags & DCLK_SYNC_FLAG_BROADCAST) && DCLK_C_conn)
+	{
+		bcast_follow(DCLK_C_conn);
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+/*
+
+
+
+
+*/
+/*BROADCAST*/
+/* When the controller broadcasts, a display holding the broadcast key
+ * drops its connection and follows the periodic advertising train. The
+ * record is only accepted if its CBC-MAC checks out.
+ */
+static struct bt_le_per_adv_sync *bcast_sync;
+static uint8_t bcast_key[16];
+static bool bcast_key_valid;
+
+static int dclk_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+							 void *cb_arg)
+{
+	if (!strcmp(name, "bkey") && (len == sizeof(bcast_key)))
+	{
+		bcast_key_valid = (read_cb(cb_arg, bcast_key, sizeof(bcast_key)) == sizeof(bcast_key));
+		return 0;
+	}
+
+	if (!strcmp(name, "cache") && (len == sizeof(dclk_cache)))
+	{
+		dclk_cache_valid = (read_cb(cb_arg, &dclk_cache, sizeof(dclk_cache)) == sizeof(dclk_cache));
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(dclk, "dclk", NULL, dclk_settings_set, NULL, NULL);
+
+static uint8_t bcast_key_read_cb(struct bt_conn *conn, uint8_t err,
+								 struct bt_gatt_read_params *params,
+								 const void *data, uint16_t length)
+{
+	if (err || !data || (length != sizeof(bcast_key)))
+	{
+		LOG_WRN("Broadcast key read failed (err %d)", err);
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (!bcast_key_valid || memcmp(bcast_key, data, sizeof(bcast_key)))
+	{
+		memcpy(bcast_key, data, sizeof(bcast_key));
+		bcast_key_valid = true;
+		settings_save_one("dclk/bkey", bcast_key, sizeof(bcast_key));
+		LOG_INF("Broadcast key stored");
+	}
+
+	return BT_GATT_ITER_STOP;
+}
+
+static struct bt_gatt_read_params bcast_key_params = {
+	.func = bcast_key_read_cb,
+	.handle_count = 1,
+};
+
+static void bcast_key_read(struct dclk_client_t *DCLK_c)
+{
+	if (DCLK_c->handles.bkey == 0xFFFF)
+	{
+		return;
+	}
+
+	bcast_key_params.single.handle = DCLK_c->handles.bkey;
+	bcast_key_params.single.offset = 0;
+
+	int err = bt_gatt_read(DCLK_c->conn, &bcast_key_params);
+	if (err)
+	{
+		LOG_WRN("Broadcast key read failed (err %d)", err);
+	}
+}
+
+static bool bcast_mac_check(const uint8_t *frame, const uint8_t *mac)
+{
+	uint8_t block[16];
+	uint8_t enc[16];
+
+	if (bt_encrypt_be(bcast_key, frame, enc))
+	{
+		return false;
+	}
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, &frame[16], DCLK_SYNC_LEN - 16);
+	block[15] = DCLK_SYNC_LEN;
+	for (size_t i = 0; i < sizeof(block); i++)
+	{
+		block[i] ^= enc[i];
+	}
+
+	if (bt_encrypt_be(bcast_key, block, enc))
+	{
+		return false;
+	}
+
+	return !memcmp(mac, enc, DCLK_MAC_LEN);
+}
+
+static bool bcast_parse(struct bt_data *data, void *user_data)
+{
+	const uint8_t **payload = user_data;
+
+	if ((data->type == BT_DATA_MANUFACTURER_DATA) &&
+		(data->data_len == DCLK_BCAST_LEN) &&
+		(sys_get_le16(data->data) == DCLK_COMPANY_ID))
+	{
+		*payload = &data->data[2];
+		return false;
+	}
+
+	return true;
+}
+
+static void bcast_recv(struct bt_le_per_adv_sync *sync,
+					   const struct bt_le_per_adv_sync_recv_info *info,
+					   struct net_buf_simple *buf)
+{
+	const uint8_t *frame = NULL;
+
+	bt_data_parse(buf, bcast_parse, &frame);
+	if (!frame)
+	{
+		return;
+	}
+
+	if (!bcast_mac_check(frame, &frame[DCLK_SYNC_LEN]))
+	{
+		LOG_WRN("Broadcast record failed authentication");
+		return;
+	}
+
+	/* A valid MAC only proves the controller sent it once. A restarted
+	 * controller is only accepted again over the encrypted link.
+	 */
+	if (atomic_test_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID) &&
+		(int32_t)(dclk_sync_stamp(frame) - DCLK_client.stamp_last) < 0)
+	{
+		LOG_WRN("Broadcast record replayed");
+		return;
+	}
+
+	on_sync_received(frame, DCLK_SYNC_LEN);
+}
+
+static void bcast_fallback(struct k_work *work)
+{
+	if (bcast_sync)
+	{
+		return;
+	}
+
+	LOG_INF("No controller broadcast found, connecting");
+	atomic_clear_bit(&DCLK_client.conn_state, DCLK_BCAST_FOLLOW);
+	stop_auto_connection();
+	start_auto_connection();
+}
+
+K_WORK_DELAYABLE_DEFINE(bcast_fallback_work, bcast_fallback);
+
+static void bcast_synced(struct bt_le_per_adv_sync *sync,
+						 struct bt_le_per_adv_sync_synced_info *info)
+{
+	LOG_INF("Following controller broadcast");
+	scan_found("Broadcast synced");
+	k_work_cancel_delayable(&bcast_fallback_work);
+	// the sequence carries on from the link, so old records are refused
+	stop_auto_connection();
+}
+
+static void bcast_term(struct bt_le_per_adv_sync *sync,
+					   const struct bt_le_per_adv_sync_term_info *info)
+{
+	LOG_INF("Controller broadcast lost (reason %d)", info->reason);
+	bcast_sync = NULL;
+	atomic_clear_bit(&DCLK_client.conn_state, DCLK_BCAST_FOLLOW);
+	link_lost_time = k_uptime_get_32();
+	if (DCLK_client.cb.link_lost)
+	{
+		DCLK_client.cb.link_lost();
+	}
+	start_auto_connection();
+}
+
+static struct bt_le_per_adv_sync_cb bcast_sync_cb = {
+	.synced = bcast_synced,
+	.term = bcast_term,
+	.recv = bcast_recv,
+};
+
+static void bcast_scan_recv(const struct bt_le_scan_recv_info *info,
+							struct net_buf_simple *buf)
+{
+	if (!atomic_test_bit(&DCLK_client.conn_state, DCLK_BCAST_FOLLOW) || bcast_sync ||
+		(0 == info->interval) || !bt_addr_le_is_bonded(BT_ID_DEFAULT, info->addr))
+	{
+		return;
+	}
+
+	struct bt_le_per_adv_sync_param param = {
+		.sid = info->sid,
+		.skip = 0,
+		.timeout = 100, // 1 s in 10 ms units
+	};
+	bt_addr_le_copy(&param.addr, info->addr);
+
+	int err = bt_le_per_adv_sync_create(&param, &bcast_sync);
+	if (err)
+	{
+		LOG_ERR("Broadcast sync failed (err %d)", err);
+		bcast_sync = NULL;
+	}
+}
+
+static struct bt_le_scan_cb bcast_scan_cb = {
+	.recv = bcast_scan_recv,
+};
+
+static void bcast_follow(struct bt_conn *conn)
+{
+	if (!bcast_key_valid ||
+		atomic_test_and_set_bit(&DCLK_client.conn_state, DCLK_BCAST_FOLLOW))
+	{
+		return;
+	}
+
+	LOG_INF("Controller broadcasting, releasing connection");
+	k_work_reschedule(&bcast_fallback_work, K_MSEC(DCLK_BCAST_FALLBACK_MS));
+	bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+}
+
+/*
+
+
+
+
+*/
+/*SCAN POLICY*/
+/* Every start scans flat out, the controller is most likely advertising
+ * fast right after a dropout. The window then shrinks in steps the longer
+ * nothing is found. Scanning is passive: the UUID is in the controller's
+ * advertising data, so no scan requests go out.
+ */
+static const struct scan_step
+{
+	uint16_t interval;
+	uint16_t window;
+	uint32_t dwell_ms;
+} scan_steps[] = {
+	{BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_INTERVAL, 10000}, // 100 %
+	{BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW, 30000},	// 50 %
+	{BT_GAP_SCAN_SLOW_INTERVAL_1, BT_GAP_SCAN_SLOW_WINDOW_1, 0},	// 1 %
 };
 
+static uint8_t scan_step;
+static uint32_t scan_start_time;
+static uint32_t scan_attempts;
+
+static void scan_step_next(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(scan_step_work, scan_step_next);
+
+static int scan_step_start(void)
+{
+	const struct scan_step *step = &scan_steps[scan_step];
+	struct bt_le_scan_param param = {
+		.type = BT_LE_SCAN_TYPE_PASSIVE,
+		.options = BT_LE_SCAN_OPT_NONE,
+		.interval = step->interval,
+		.window = step->window,
+	};
+	int err;
+
+	if (atomic_test_bit(&DCLK_client.conn_state, DCLK_BCAST_FOLLOW))
+	{
+		// only looking for the periodic train. bt_scan still sees the
+		// reports, without filters it never connects.
+		bt_scan_filter_disable();
+		err = bt_le_scan_start(&param, NULL);
+	}
+	else
+	{
+		err = bt_scan_filter_enable(BT_SCAN_UUID_FILTER | BT_SCAN_ADDR_FILTER, false);
+		if (!err)
+		{
+			err = bt_scan_params_set(&param);
+		}
+		if (!err)
+		{
+			err = bt_scan_start(BT_SCAN_TYPE_SCAN_PASSIVE);
+		}
+	}
+
+	if (!err && step->dwell_ms)
+	{
+		k_work_reschedule(&scan_step_work, K_MSEC(step->dwell_ms));
+	}
+	return err;
+}
+
+static void scan_step_next(struct k_work *work)
+{
+	if (scan_step >= ARRAY_SIZE(scan_steps) - 1)
+	{
+		return;
+	}
+
+	scan_step++;
+	LOG_INF("Nothing found in %d ms, scan step %d", k_uptime_get_32() - scan_start_time,
+			scan_step);
+
+	(void)bt_scan_stop();
+	int err = scan_step_start();
+	if (err)
+	{
+		LOG_ERR("Failed to restart scan err= %d", err);
+	}
+}
+
+/* Log how long the attempt took, once it found the controller */
+static void scan_found(const char *how)
+{
+	k_work_cancel_delayable(&scan_step_work);
+	LOG_INF("%s after %d ms scanning, attempt %d, step %d", how,
+			k_uptime_get_32() - scan_start_time, scan_attempts, scan_step);
+}
+
 /*
 
 
@@ -51,6 +552,7 @@ enum
 
 void stop_auto_connection(void)
 {
+	k_work_cancel_delayable(&scan_step_work);
 	int err = bt_scan_stop();
 	// int err = bt_conn_create_auto_stop();
 	if (err)
@@ -62,8 +564,11 @@ void stop_auto_connection(void)
 
 void start_auto_connection(void)
 {
+	scan_step = 0;
+	scan_start_time = k_uptime_get_32();
+	scan_attempts++;
 
-	int err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
+	int err = scan_step_start();
 
 	// int err = bt_conn_le_create_auto(create_params,
 	// 								 BT_LE_CONN_PARAM_DEFAULT);
@@ -71,7 +576,9 @@ void start_auto_connection(void)
 	if (err)
 	{
 		LOG_ERR("Failed to start connection err= %d", err);
+		return;
 	}
+	boot_mark(BOOT_SCAN);
 	LOG_INF("Auto Connection Active");
 	return;
 }
@@ -87,17 +594,31 @@ static uint8_t on_received(struct bt_conn *conn,
 		return BT_GATT_ITER_STOP;
 	}
 
-	if (params->value_handle == DCLK_client.dclock_notif_params.value_handle)
+	if (params->value_handle == DCLK_client.dsync_notif_params.value_handle)
+	{
+		return on_sync_received(data, length);
+	}
+	else if (params->value_handle == DCLK_client.dclock_notif_params.value_handle)
 	{
 		// LOG_INF("D_CLOCK updated");
+		if (length < sizeof(uint32_t))
+		{
+			return BT_GATT_ITER_CONTINUE;
+		}
+		boot_mark(BOOT_LIVE);
 		if (DCLK_client.cb.received_clock)
 		{
-			return DCLK_client.cb.received_clock(*(uint32_t *)data);
+			// legacy controllers send whole seconds
+			return DCLK_client.cb.received_clock(sys_get_le32(data) * MSEC_PER_SEC);
 		}
 	}
 	else if (params->value_handle == DCLK_client.dstate_notif_params.value_handle)
 	{
 		// LOG_INF("D_STATE updated");
+		if (length < sizeof(uint8_t))
+		{
+			return BT_GATT_ITER_CONTINUE;
+		}
 		if (DCLK_client.cb.received_state)
 		{
 			return DCLK_client.cb.received_state(*(uint8_t *)data);
@@ -106,10 +627,48 @@ static uint8_t on_received(struct bt_conn *conn,
 	return BT_GATT_ITER_CONTINUE;
 }
 
+static int dclk_client_subscribe_sync(struct dclk_client_t *DCLK_c)
+{
+	int err;
+
+	atomic_set_bit(&DCLK_c->conn_state, DCLK_SYNC_NOTIF_ENABLED);
+	// the controller may have restarted its sequence
+	atomic_clear_bit(&DCLK_c->conn_state, DCLK_SEQ_VALID);
+
+	LOG_DBG("Subsribing");
+	DCLK_c->dsync_notif_params.notify = on_received;
+	DCLK_c->dsync_notif_params.value = BT_GATT_CCC_NOTIFY;
+	DCLK_c->dsync_notif_params.value_handle = DCLK_c->handles.dsync;
+	DCLK_c->dsync_notif_params.ccc_handle = DCLK_c->handles.dsync_ccc;
+	atomic_set_bit(DCLK_c->dsync_notif_params.flags,
+				   BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+
+	err = bt_gatt_subscribe(DCLK_c->conn, &DCLK_c->dsync_notif_params);
+	if (err)
+	{
+		LOG_ERR("Subscribe DSYNC failed (err %d)", err);
+		atomic_clear_bit(&DCLK_c->conn_state, DCLK_SYNC_NOTIF_ENABLED);
+	}
+	else
+	{
+		boot_mark(BOOT_SUBSCRIBED);
+		LOG_DBG("[SUBSCRIBED DSYNC]");
+	}
+
+	return err;
+}
+
 int dclk_client_subscribe(struct dclk_client_t *DCLK_c)
 {
 	int err;
 
+	// the sync record carries clock and state, the other two are only
+	// needed for controllers without it
+	if (DCLK_c->handles.dsync != 0xFFFF)
+	{
+		return dclk_client_subscribe_sync(DCLK_c);
+	}
+
 	atomic_set_bit(&DCLK_c->conn_state, DCLK_CLOCK_NOTIF_ENABLED);
 
 	LOG_DBG("Subsribing");
@@ -128,9 +687,12 @@ int dclk_client_subscribe(struct dclk_client_t *DCLK_c)
 	}
 	else
 	{
+		boot_mark(BOOT_SUBSCRIBED);
 		LOG_DBG("[SUBSCRIBED DCLOCK]");
 	}
 
+	atomic_set_bit(&DCLK_c->conn_state, DCLK_STATE_NOTIF_ENABLED);
+
 	DCLK_c->dstate_notif_params.notify = on_received;
 	DCLK_c->dstate_notif_params.value = BT_GATT_CCC_NOTIFY;
 	DCLK_c->dstate_notif_params.value_handle = DCLK_c->handles.dstate;
@@ -227,11 +789,152 @@ int dclk_client_handles_assign(struct bt_gatt_dm *dm,
 	LOG_INF("Found handle for CCC of DCLK dstate characteristic.");
 	DCLK_c->handles.dstate_ccc = gatt_desc->handle;
 
+	/* DCLK dsync Characteristic, optional on older controllers */
+	gatt_chrc = bt_gatt_dm_char_by_uuid(dm, BT_UUID_DCLK_SYNC);
+	if (!gatt_chrc)
+	{
+		LOG_WRN("Missing DCLK dsync characteristic.");
+	}
+	else
+	{
+		/* DCLK dsync */
+		gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc, BT_UUID_DCLK_SYNC);
+		if (!gatt_desc)
+		{
+			LOG_ERR("Missing DCLK dsync value descriptor in characteristic.");
+			return -EINVAL;
+		}
+		LOG_INF("Found handle for DCLK dsync characteristic.");
+		DCLK_c->handles.dsync = gatt_desc->handle;
+
+		/* DCLK dsync CCC */
+		gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc, BT_UUID_GATT_CCC);
+		if (!gatt_desc)
+		{
+			LOG_ERR("Missing DCLK dsync CCC in characteristic.");
+			return -EINVAL;
+		}
+		LOG_INF("Found handle for CCC of DCLK dsync characteristic.");
+		DCLK_c->handles.dsync_ccc = gatt_desc->handle;
+	}
+
+	/* DCLK broadcast key Characteristic, optional on older controllers */
+	gatt_chrc = bt_gatt_dm_char_by_uuid(dm, BT_UUID_DCLK_BKEY);
+	if (gatt_chrc)
+	{
+		gatt_desc = bt_gatt_dm_desc_by_uuid(dm, gatt_chrc, BT_UUID_DCLK_BKEY);
+		if (gatt_desc)
+		{
+			LOG_INF("Found handle for DCLK broadcast key characteristic.");
+			DCLK_c->handles.bkey = gatt_desc->handle;
+		}
+	}
+
 	/* Assign connection instance. */
 	DCLK_c->conn = bt_gatt_dm_conn_get(dm);
 	return 0;
 }
 
+/*
+
+
+
+
+*/
+/*HANDLE CACHE*/
+/* Drop the subscriptions made with stale handles. ATT requests go out in
+ * order, so the CCC writes finish before discovery subscribes again.
+ */
+static void dclk_client_unsubscribe(struct dclk_client_t *DCLK_c)
+{
+	if (atomic_test_and_clear_bit(&DCLK_c->conn_state, DCLK_SYNC_NOTIF_ENABLED))
+	{
+		bt_gatt_unsubscribe(DCLK_c->conn, &DCLK_c->dsync_notif_params);
+	}
+	if (atomic_test_and_clear_bit(&DCLK_c->conn_state, DCLK_CLOCK_NOTIF_ENABLED))
+	{
+		bt_gatt_unsubscribe(DCLK_c->conn, &DCLK_c->dclock_notif_params);
+	}
+	if (atomic_test_and_clear_bit(&DCLK_c->conn_state, DCLK_STATE_NOTIF_ENABLED))
+	{
+		bt_gatt_unsubscribe(DCLK_c->conn, &DCLK_c->dstate_notif_params);
+	}
+}
+
+static uint8_t db_hash_read_cb(struct bt_conn *conn, uint8_t err,
+							   struct bt_gatt_read_params *params,
+							   const void *data, uint16_t length)
+{
+	if (err || !data || (length != sizeof(dclk_cache.db_hash)))
+	{
+		LOG_WRN("Database hash read failed (err %d)", err);
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (dclk_cache_valid)
+	{
+		if (memcmp(dclk_cache.db_hash, data, length))
+		{
+			// the controller firmware changed, handles may have moved
+			LOG_INF("Database hash changed, rediscovering");
+			dclk_cache_valid = false;
+			settings_delete("dclk/cache");
+			dclk_client_unsubscribe(&DCLK_client);
+			gatt_discover(conn);
+		}
+		return BT_GATT_ITER_STOP;
+	}
+
+	bt_addr_le_copy(&dclk_cache.addr, bt_conn_get_dst(conn));
+	memcpy(dclk_cache.db_hash, data, length);
+	dclk_cache.handles = DCLK_client.handles;
+	dclk_cache_valid = true;
+	settings_save_one("dclk/cache", &dclk_cache, sizeof(dclk_cache));
+	LOG_INF("Handles cached");
+
+	return BT_GATT_ITER_STOP;
+}
+
+static const struct bt_uuid_16 db_hash_uuid = BT_UUID_INIT_16(BT_UUID_GATT_DB_HASH_VAL);
+
+static struct bt_gatt_read_params db_hash_params;
+
+static void db_hash_read(struct bt_conn *conn)
+{
+	// the stack advances start_handle while reading by type, so the
+	// range is set again for every connection
+	db_hash_params.func = db_hash_read_cb;
+	db_hash_params.handle_count = 0;
+	db_hash_params.by_uuid.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	db_hash_params.by_uuid.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	db_hash_params.by_uuid.uuid = &db_hash_uuid.uuid;
+
+	int err = bt_gatt_read(conn, &db_hash_params);
+	if (err)
+	{
+		LOG_WRN("Database hash read failed (err %d)", err);
+	}
+}
+
+static bool dclk_cache_match(struct bt_conn *conn)
+{
+	return dclk_cache_valid && !bt_addr_le_cmp(&dclk_cache.addr, bt_conn_get_dst(conn));
+}
+
+/* Subscribe with cached handles, then check the database hash in the
+ * background in case the controller firmware changed.
+ */
+static void dclk_cache_resume(struct bt_conn *conn)
+{
+	LOG_INF("Using cached handles");
+	DCLK_client.handles = dclk_cache.handles;
+	DCLK_client.conn = conn;
+
+	dclk_client_subscribe(&DCLK_client);
+	bcast_key_read(&DCLK_client);
+	db_hash_read(conn);
+}
+
 static void discovery_complete(struct bt_gatt_dm *dm,
 							   void *context)
 {
@@ -241,6 +944,8 @@ static void discovery_complete(struct bt_gatt_dm *dm,
 	dclk_client_handles_assign(dm, DCLK);
 	LOG_DBG("Attempting to Subscribe");
 	dclk_client_subscribe(DCLK);
+	bcast_key_read(DCLK);
+	db_hash_read(DCLK->conn);
 
 	bt_gatt_dm_data_release(dm);
 }
@@ -327,7 +1032,16 @@ static void connected(struct bt_conn *conn, uint8_t conn_err)
 		LOG_INF("Security Set");
 	}
 
-	gatt_discover(conn);
+	link_up_time = k_uptime_get_32();
+	first_frame_pending = true;
+	LOG_INF("Connected %d ms after the scan started", link_up_time - scan_start_time);
+	boot_mark(BOOT_CONN);
+
+	// with cached handles, subscribe as soon as the link is encrypted
+	if (!dclk_cache_match(conn))
+	{
+		gatt_discover(conn);
+	}
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
@@ -348,6 +1062,13 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 
 	bt_conn_unref(DCLK_C_conn);
 	DCLK_C_conn = NULL;
+	link_lost_time = k_uptime_get_32();
+	// the controller may reset or power off before the next record
+	atomic_clear_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID);
+	if (DCLK_client.cb.link_lost)
+	{
+		DCLK_client.cb.link_lost();
+	}
 
 	start_auto_connection();
 	if (err)
@@ -367,6 +1088,10 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 	if (!err)
 	{
 		LOG_INF("Security changed: %s level %u", addr, level);
+		if (dclk_cache_match(conn))
+		{
+			dclk_cache_resume(conn);
+		}
 	}
 	else
 	{
@@ -375,10 +1100,30 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 	}
 }
 
+static bool le_param_req(struct bt_conn *conn, struct bt_le_conn_param *param)
+{
+	// the controller picks short intervals while running, long ones while idle
+	LOG_INF("Conn param request: interval %d-%d, latency %d, timeout %d",
+			param->interval_min, param->interval_max, param->latency, param->timeout);
+	return true;
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+							 uint16_t latency, uint16_t timeout)
+{
+	LOG_INF("Conn params: interval %d us, latency %d, timeout %d ms",
+			interval * 1250, latency, timeout * 10);
+	DCLK_client.latency_max = 0;
+	DCLK_client.latency_sum = 0;
+	DCLK_client.latency_cnt = 0;
+}
+
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected = connected,
 	.disconnected = disconnected,
 	.security_changed = security_changed,
+	.le_param_req = le_param_req,
+	.le_param_updated = le_param_updated,
 };
 
 /*
@@ -395,6 +1140,11 @@ static void pairing_complete(struct bt_conn *conn, bool bonded)
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
 	LOG_INF("Pairing completed: %s, bonded: %d", addr, bonded);
+
+	if (bonded)
+	{
+		scan_filters_set();
+	}
 }
 
 static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
@@ -476,6 +1226,7 @@ static void scan_connecting(struct bt_scan_device_info *device_info,
 
 	bt_addr_le_to_str(device_info->recv_info->addr, addr, sizeof(addr));
 	LOG_INF("Scan connecting: %s", addr);
+	scan_found("Controller found");
 	DCLK_C_conn = bt_conn_ref(conn);
 	// if (DCLK_C_conn == bt_conn_ref(conn))
 	// {
@@ -486,17 +1237,24 @@ static void scan_connecting(struct bt_scan_device_info *device_info,
 BT_SCAN_CB_INIT(scan_cb, scan_filter_match, NULL,
 				scan_connecting_error, scan_connecting);
 
-static int scan_init(void)
+static void scan_filter_bond(const struct bt_bond_info *info, void *data)
+{
+	int *err = data;
+
+	if (!*err)
+	{
+		*err = bt_scan_filter_add(BT_SCAN_FILTER_TYPE_ADDR, &info->addr);
+	}
+}
+
+/* Directed adverts from the controller carry no data, so the bonded
+ * controller is also matched by address. Either filter connects.
+ */
+static int scan_filters_set(void)
 {
 	int err;
-	struct bt_scan_init_param scan_init = {
-		.connect_if_match = 1,
-		.conn_param = NULL,
-		.scan_param = NULL,
-	};
 
-	bt_scan_init(&scan_init);
-	bt_scan_cb_register(&scan_cb);
+	bt_scan_filter_remove_all();
 
 	err = bt_scan_filter_add(BT_SCAN_FILTER_TYPE_UUID, BT_UUID_DCLK);
 	if (err)
@@ -505,10 +1263,37 @@ static int scan_init(void)
 		return err;
 	}
 
-	err = bt_scan_filter_enable(BT_SCAN_UUID_FILTER, false);
+	bt_foreach_bond(BT_ID_DEFAULT, scan_filter_bond, &err);
+	if (err)
+	{
+		LOG_ERR("Address filters cannot be set (err %d)", err);
+		return err;
+	}
+
+	err = bt_scan_filter_enable(BT_SCAN_UUID_FILTER | BT_SCAN_ADDR_FILTER, false);
 	if (err)
 	{
 		LOG_ERR("Filters cannot be turned on (err %d)", err);
+	}
+
+	return err;
+}
+
+static int scan_init(void)
+{
+	int err;
+	struct bt_scan_init_param scan_init = {
+		.connect_if_match = 1,
+		.conn_param = NULL,
+		.scan_param = NULL,
+	};
+
+	bt_scan_init(&scan_init);
+	bt_scan_cb_register(&scan_cb);
+
+	err = scan_filters_set();
+	if (err)
+	{
 		return err;
 	}
 
@@ -523,6 +1308,57 @@ static int scan_init(void)
 
 */
 /*API*/
+int dclk_client_clock_get(uint32_t *clock, uint8_t *state)
+{
+	if (!atomic_test_bit(&DCLK_client.conn_state, DCLK_SYNC_VALID))
+	{
+		return -EAGAIN;
+	}
+
+	*clock = sync_remaining(&DCLK_client.sync, k_uptime_get_32());
+	*state = DCLK_client.sync.state;
+
+	return 0;
+}
+
+static void client_bt_ready(int err)
+{
+	if (err)
+	{
+		LOG_ERR("Bluetooth enable failed (err %d)", err);
+		return;
+	}
+	boot_mark(BOOT_BT_READY);
+
+	if (IS_ENABLED(CONFIG_SETTINGS))
+	{
+		// only the subtrees the client needs: bonds, then key and handle cache
+		err = settings_load_subtree("bt");
+		if (!err)
+		{
+			err = settings_load_subtree("dclk");
+		}
+		if (err)
+		{
+			LOG_ERR("Could not load settings (err %d)", err);
+		}
+		else
+		{
+			LOG_INF("Settings Loaded Successfully\n");
+		}
+	}
+	boot_mark(BOOT_SETTINGS);
+
+	err = scan_init();
+	if (err != 0)
+	{
+		LOG_ERR("scan_init failed (err %d)", err);
+		return;
+	}
+
+	start_auto_connection();
+}
+
 int dclk_client_init(struct dclk_client_cb *callbacks, unsigned int custom_passkey)
 {
 
@@ -538,13 +1374,6 @@ int dclk_client_init(struct dclk_client_cb *callbacks, unsigned int custom_passk
 		LOG_ERR("No DCLK callbacks set");
 	}
 
-	err = bt_enable(NULL);
-	if (err)
-	{
-		LOG_ERR("Bluetooth enable failed (err %d)", err);
-		return 0;
-	}
-
 	err = bt_conn_auth_cb_register(&auth_cb_display);
 	if (err)
 	{
@@ -559,31 +1388,33 @@ int dclk_client_init(struct dclk_client_cb *callbacks, unsigned int custom_passk
 		return 0;
 	}
 
-	if (IS_ENABLED(CONFIG_SETTINGS))
+	if (IS_ENABLED(CONFIG_BT_PER_ADV_SYNC))
 	{
-		settings_load();
-
-		LOG_INF("Settings Loaded Successfully\n");
-	}
-	else
-	{
-		LOG_INF("Could not load settings");
+		bt_le_scan_cb_register(&bcast_scan_cb);
+		bt_le_per_adv_sync_cb_register(&bcast_sync_cb);
 	}
 
-	err = scan_init();
-	if (err != 0)
+	// the controller comes up in the background, scanning starts from
+	// client_bt_ready so main is not held up
+	err = bt_enable(client_bt_ready);
+	if (err)
 	{
-		LOG_ERR("scan_init failed (err %d)", err);
+		LOG_ERR("Bluetooth enable failed (err %d)", err);
 		return 0;
 	}
 
-	start_auto_connection();
-
 	return 0;
 }
 
 int dclk_pairing(bool enable)
 {
+	// scanning is started by client_bt_ready once the stack is up
+	if (!bt_is_ready())
+	{
+		LOG_INF("BT_NOT_READY");
+		return -EAGAIN;
+	}
+
 	stop_auto_connection();
 
 	int err = bt_unpair(BT_ID_DEFAULT, BT_ADDR_LE_ANY);
@@ -596,10 +1427,12 @@ int dclk_pairing(bool enable)
 		LOG_INF("Bond deleted succesfully \n");
 	}
 
-	while (!bt_is_ready())
-	{
-		LOG_INF("BT_NOT_READY");
-	}
+	// the key and handles belong to the old bond
+	bcast_key_valid = false;
+	settings_delete("dclk/bkey");
+	dclk_cache_valid = false;
+	settings_delete("dclk/cache");
+	scan_filters_set();
 
 	start_auto_connection();
 
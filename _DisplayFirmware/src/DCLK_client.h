@@ -36,9 +36,102 @@ extern "C"
 #define BT_UUID_DCLK_CLOCK_VAL \
     BT_UUID_128_ENCODE(0x00001556, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
 
+/** @brief Sync Characteristic UUID. */
+#define BT_UUID_DCLK_SYNC_VAL \
+    BT_UUID_128_ENCODE(0x00001557, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
+
+/** @brief Broadcast Key Characteristic UUID. */
+#define BT_UUID_DCLK_BKEY_VAL \
+    BT_UUID_128_ENCODE(0x00001558, 0x1212, 0xefde, 0x1523, 0x785feabcd123)
+
 #define BT_UUID_DCLK BT_UUID_DECLARE_128(BT_UUID_DCLK_VAL)
 #define BT_UUID_DCLK_STATE BT_UUID_DECLARE_128(BT_UUID_DCLK_STATE_VAL)
 #define BT_UUID_DCLK_CLOCK BT_UUID_DECLARE_128(BT_UUID_DCLK_CLOCK_VAL)
+#define BT_UUID_DCLK_SYNC BT_UUID_DECLARE_128(BT_UUID_DCLK_SYNC_VAL)
+#define BT_UUID_DCLK_BKEY BT_UUID_DECLARE_128(BT_UUID_DCLK_BKEY_VAL)
+
+    /** @brief Sync record wire format
+     *
+     * One fixed-layout little-endian record from the controller carries
+     * clock and state together, tagged with a sequence number.
+     */
+#define DCLK_SYNC_SEQ_OFS 0
+#define DCLK_SYNC_STATE_OFS 2
+#define DCLK_SYNC_FLAGS_OFS 3
+#define DCLK_SYNC_CLOCK_OFS 4
+#define DCLK_SYNC_STAMP_OFS 8
+#define DCLK_SYNC_DEADLINE_OFS 12
+#define DCLK_SYNC_EPOCH_OFS 16
+#define DCLK_SYNC_LEN 18
+
+/** Record was sent because of a state or connection event */
+#define DCLK_SYNC_FLAG_EVENT BIT(0)
+/** Controller is in pairing mode */
+#define DCLK_SYNC_FLAG_PAIRING BIT(1)
+/** Record is also broadcast in periodic advertising */
+#define DCLK_SYNC_FLAG_BROADCAST BIT(2)
+
+/** @brief Broadcast format
+ *
+ * Manufacturer data in periodic advertising: company id, sync record,
+ * then a truncated AES CBC-MAC over the record.
+ */
+#define DCLK_COMPANY_ID 0xFFFF
+#define DCLK_MAC_LEN 4
+#define DCLK_BCAST_LEN (2 + DCLK_SYNC_LEN + DCLK_MAC_LEN)
+
+    /** @brief Field accessors, read in place from a received record. */
+    static inline uint16_t dclk_sync_seq(const uint8_t *frame)
+    {
+        return sys_get_le16(&frame[DCLK_SYNC_SEQ_OFS]);
+    }
+
+    static inline uint8_t dclk_sync_state(const uint8_t *frame)
+    {
+        return frame[DCLK_SYNC_STATE_OFS];
+    }
+
+    static inline uint8_t dclk_sync_flags(const uint8_t *frame)
+    {
+        return frame[DCLK_SYNC_FLAGS_OFS];
+    }
+
+    static inline uint32_t dclk_sync_clock(const uint8_t *frame)
+    {
+        return sys_get_le32(&frame[DCLK_SYNC_CLOCK_OFS]);
+    }
+
+    static inline uint32_t dclk_sync_stamp(const uint8_t *frame)
+    {
+        return sys_get_le32(&frame[DCLK_SYNC_STAMP_OFS]);
+    }
+
+    static inline uint32_t dclk_sync_deadline(const uint8_t *frame)
+    {
+        return sys_get_le32(&frame[DCLK_SYNC_DEADLINE_OFS]);
+    }
+
+    static inline uint16_t dclk_sync_epoch(const uint8_t *frame)
+    {
+        return sys_get_le16(&frame[DCLK_SYNC_EPOCH_OFS]);
+    }
+
+    /** @brief Local clock model built from the last accepted record.
+     *
+     * stamp and deadline are in ms of local uptime.
+     */
+    struct dclk_sync
+    {
+        uint32_t stamp;
+        uint32_t deadline;
+        /** time remaining at stamp */
+        uint32_t remaining;
+        uint16_t epoch;
+        uint16_t seq;
+        /** clock state 0 - running, 1 - paused, 2 - stopped */
+        uint8_t state;
+        uint8_t flags;
+    };
 
     /** @brief Handles on the connected peer device that are needed to interact with
      * the device.
@@ -59,6 +152,18 @@ extern "C"
         uint16_t dclock;
 
         uint16_t dstate_ccc;
+
+        /** Handle of the DCLK sync characteristic, as provided by
+         *  a discovery.
+         */
+        uint16_t dsync;
+
+        uint16_t dsync_ccc;
+
+        /** Handle of the DCLK broadcast key characteristic, as provided
+         *  by a discovery.
+         */
+        uint16_t bkey;
     };
 
     /** @brief DCLK Client callback structure. */
@@ -88,6 +193,22 @@ extern "C"
          */
         uint8_t (*received_state)(uint8_t data);
 
+        /** @brief DCLK epoch received callback.
+         *
+         * Called with every sync record, before its state and clock. The
+         * epoch changes whenever the controller starts a new shot.
+         *
+         * @param[in] epoch epoch of the record.
+         */
+        void (*received_epoch)(uint16_t epoch);
+
+        /** @brief Link to the controller lost callback.
+         *
+         * The connection dropped or the broadcast train was lost. The next
+         * received clock is the first one after the gap.
+         */
+        void (*link_lost)(void);
+
         /** @brief notifications disabled callback.
          *
          * notifications have been disabled.
@@ -119,6 +240,27 @@ extern "C"
         /** GATT write parameters for DCLK dstate Characteristic. */
         struct bt_gatt_subscribe_params dstate_notif_params;
 
+        /** GATT subscribe parameters for DCLK sync Characteristic. */
+        struct bt_gatt_subscribe_params dsync_notif_params;
+
+        /** Local uptime minus controller uptime, in ms. */
+        uint32_t offset;
+
+        /** Controller stamp of the last record, to spot a restart. */
+        uint32_t stamp_last;
+
+        /** Worst notify-to-receive time above the fastest record, in ms,
+         *  since the last connection parameter change.
+         */
+        uint32_t latency_max;
+
+        /** Sum and count of the same, for the average. */
+        uint32_t latency_sum;
+        uint32_t latency_cnt;
+
+        /** Last sync record, deadline mapped to local uptime. */
+        struct dclk_sync sync;
+
         /** Application callbacks. */
         struct dclk_client_cb cb;
     };
@@ -158,6 +300,19 @@ extern "C"
      */
     int dclk_client_subscribe(struct dclk_client_t *DCLK);
 
+    /** @brief Get the locally interpolated clock.
+     *
+     * The remaining time is counted down from the last sync record, so it
+     * stays current between notifications.
+     *
+     * @param[out] clock remaining time in ms.
+     * @param[out] state clock state.
+     *
+     * @retval 0 If the operation was successful.
+     * @retval (-EAGAIN) No sync record has been received yet.
+     */
+    int dclk_client_clock_get(uint32_t *clock, uint8_t *state);
+
     /** @brief Initialize the DCLK Client module.
      *
      * This function initializes the DCLK Client module with callbacks provided by
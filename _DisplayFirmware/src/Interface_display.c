@@ -13,31 +13,39 @@
 #include <zephyr/settings/settings.h>
 
 #include "Interface_display.h"
+#include "Boot.h"
+#include "Strip.h"
 
 #include <zephyr/drivers/led_strip.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/spi.h>
 #include <zephyr/sys/util.h>
 
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MODULE_DECLARE(Display_app, LOG_LEVEL_DBG);
+
 #define STRIP_NODE DT_ALIAS(led_strip)
 #define STRIP_NUM_PIXELS DT_PROP(DT_ALIAS(led_strip), chain_length)
 
-#define DELAY_TIME K_MSEC(50)
-
 #define RGB(_r, _g, _b)                 \
 	{                                   \
 		.r = (_r), .g = (_g), .b = (_b) \
 	}
 
-static const struct led_rgb colors[] = {
+/* Digit colour per shot clock state: running, stopped, expired, then
+ * running without the controller
+ */
+#define LOOK_HOLDOVER 3
+
+static const struct led_rgb state_colors[] = {
+	RGB(0x0f, 0x0f, 0x0f), /* white */
+	RGB(0x0f, 0x08, 0x00), /* amber */
 	RGB(0x0f, 0x00, 0x00), /* red */
-	RGB(0x00, 0x0f, 0x00), /* green */
-	RGB(0x00, 0x00, 0x0f), /* blue */
+	[LOOK_HOLDOVER] = RGB(0x00, 0x06, 0x0f), /* blue */
 };
 
-struct led_rgb pixels[STRIP_NUM_PIXELS];
-
-static const struct device *const strip = DEVICE_DT_GET(STRIP_NODE);
 
 #define SW0_NODE DT_NODELABEL(button0)
 #define SW1_NODE DT_NODELABEL(button1)
@@ -46,38 +54,455 @@ static const struct device *const strip = DEVICE_DT_GET(STRIP_NODE);
 
 
 
-struct k_timer d_timer;
-static uint8_t d_state = 0;		 // shot clock state
-static uint32_t d_clock = 10000; // shot clock in ms
-
 static struct interface_cb inter_cb;
 /*DCLOCK*/
 
+/*
+
+
+*/
+/*SEGMENT MAP*/
+/* The printed frame has two digits, tens first. The strip runs through
+ * segments a to g of each digit in order, so every segment is one run
+ * of SEG_LEDS pixels. Any pixels past the last segment stay dark.
+ */
+#define STRIP_DIGITS 2
+#define STRIP_SEGMENTS 7
+#define SEG_LEDS (STRIP_NUM_PIXELS / (STRIP_DIGITS * STRIP_SEGMENTS))
+
+BUILD_ASSERT(SEG_LEDS > 0, "led-strip chain-length is too short for two digits");
+
+#define DIGIT_DASH 10
+#define DIGIT_BLANK 11
+
+/* bit n lights segment a + n */
+static const uint8_t digit_segments[] = {
+	0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f,
+	[DIGIT_DASH] = 0x40,
+	[DIGIT_BLANK] = 0x00,
+};
+
+struct seg_range
+{
+	uint16_t first;
+	uint16_t count;
+};
+
+#define SEG_RANGE(seg, digit) {.first = ((digit) * STRIP_SEGMENTS + (seg)) * SEG_LEDS, .count = SEG_LEDS}
+#define DIGIT_RANGES(digit) {LISTIFY(STRIP_SEGMENTS, SEG_RANGE, (, ), digit)}
+
+static const struct seg_range seg_leds[STRIP_DIGITS][STRIP_SEGMENTS] = {
+	DIGIT_RANGES(0),
+	DIGIT_RANGES(1),
+};
+
+/*
 
 
-static void strip_init(void)
+*/
+/*COUNTDOWN*/
+/* The display keeps its own copy of the clock. Every record from the
+ * controller reseeds the deadline, d_timer ticks on the tenths of the
+ * shown time and wakes the renderer, so a late or lost record does not
+ * freeze the digits. A small disagreement is slewed out over a few ticks
+ * instead of jumping, a large one (a new shot, a missed stop) snaps.
+ *
+ * If the link drops while running the countdown carries on in blue for
+ * up to COUNTDOWN_HOLDOVER_MS, then shows dashes. The first clock after
+ * the gap is reconciled without the time going back up: a controller
+ * that is ahead is followed as usual, one that is behind by less than
+ * the gap is caught up by running the shown clock at half speed.
+ */
+#define COUNTDOWN_TICK_MS 100
+#define COUNTDOWN_SLEW_MS 10  // per tick, the shown clock runs at 0.9x to 1.1x
+#define COUNTDOWN_SNAP_MS 1000
+#define COUNTDOWN_HOLDOVER_MS 30000
+#define COUNTDOWN_RECONCILE_SLEW_MS 50 // per tick, the shown clock runs at 0.5x
+#define COUNTDOWN_RUNNING 0
+
+struct countdown
+{
+	uint32_t deadline; // uptime (ms) the controller's clock reaches zero
+	int32_t slew;	   // ms the shown deadline is still behind it
+	int32_t slew_step; // most slew taken out per tick
+	uint32_t held;	   // remaining (ms) while not running
+	uint32_t lost_at;  // uptime (ms) the link dropped, while in holdover
+	uint16_t epoch;	   // of the last clock, from sync records
+	uint8_t state;
+	bool seeded;
+	bool holdover;
+	bool new_epoch; // the next clock starts a new shot
+};
+
+static struct countdown countdown = {
+	.held = 10000,
+	.slew_step = COUNTDOWN_SLEW_MS,
+};
+static struct k_spinlock countdown_lock;
+static struct interface_holdover_stats holdover_stats;
+
+K_SEM_DEFINE(frame_sem, 0, 1);
+
+/* Time on the display, call with countdown_lock held */
+static uint32_t countdown_shown(uint32_t now)
 {
-	if (device_is_ready(strip))
+	if (COUNTDOWN_RUNNING != countdown.state)
 	{
-		LOG_INF("Found LED strip device %s", strip->name);
+		return countdown.held;
 	}
-	else
+
+	int32_t remaining = (int32_t)(countdown.deadline - countdown.slew - now);
+
+	return (remaining > 0) ? remaining : 0;
+}
+
+/* Holdover ran out and the time is no longer trusted, call with
+ * countdown_lock held
+ */
+static bool countdown_stale(uint32_t now)
+{
+	return countdown.holdover && ((now - countdown.lost_at) >= COUNTDOWN_HOLDOVER_MS);
+}
+
+static void countdown_tick(struct k_timer *timer)
+{
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key = k_spin_lock(&countdown_lock);
+
+	countdown.slew -= CLAMP(countdown.slew, -countdown.slew_step, countdown.slew_step);
+	if (0 == countdown.slew)
+	{
+		countdown.slew_step = COUNTDOWN_SLEW_MS;
+	}
+
+	// in holdover keep ticking until the dashes are up
+	if (countdown.holdover ? countdown_stale(now) : (0 == countdown_shown(now)))
+	{
+		k_timer_stop(timer);
+	}
+	k_spin_unlock(&countdown_lock, key);
+
+	k_sem_give(&frame_sem);
+}
+
+K_TIMER_DEFINE(d_timer, countdown_tick, NULL);
+
+/* Restart the ticks on the tenths of the shown time, call with
+ * countdown_lock held
+ */
+static void countdown_align(uint32_t now)
+{
+	uint32_t shown = countdown_shown(now);
+
+	if ((COUNTDOWN_RUNNING != countdown.state) || ((0 == shown) && !countdown.holdover))
+	{
+		k_timer_stop(&d_timer);
+		return;
+	}
+
+	uint32_t to_tick = shown % COUNTDOWN_TICK_MS;
+
+	k_timer_start(&d_timer, K_MSEC(to_tick ? to_tick : COUNTDOWN_TICK_MS),
+				  K_MSEC(COUNTDOWN_TICK_MS));
+}
+
+/*
+
+
+*/
+/*RENDER*/
+/* The render thread draws the countdown into the back buffer, streams it
+ * out through Strip.c and flips buffers, so the front always holds the
+ * last frame sent.
+ */
+#define RENDER_STACKSIZE 1024
+#define RENDER_PRIORITY 10
+#define STRIP_BENCH_FRAMES 64
+
+static struct led_rgb pixels[2][STRIP_NUM_PIXELS];
+static uint8_t back;
+
+static struct interface_render_stats render_stats;
+
+K_SEM_DEFINE(strip_ready, 0, 1);
+
+static void strip_draw(struct led_rgb *buf, const uint8_t digits[STRIP_DIGITS], struct led_rgb color)
+{
+	memset(buf, 0, sizeof(pixels[0]));
+
+	for (int d = 0; d < STRIP_DIGITS; d++)
+	{
+		uint8_t segments = digit_segments[digits[d]];
+
+		for (int seg = 0; seg < STRIP_SEGMENTS; seg++)
+		{
+			if (!(segments & BIT(seg)))
+			{
+				continue;
+			}
+			for (int i = 0; i < seg_leds[d][seg].count; i++)
+			{
+				buf[seg_leds[d][seg].first + i] = color;
+			}
+		}
+	}
+}
+
+static int strip_push(void)
+{
+	uint32_t start = k_cycle_get_32();
+	int err = strip_update(pixels[back], STRIP_NUM_PIXELS);
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+	back ^= 1;
+	render_stats.frames++;
+	render_stats.us_last = us;
+	render_stats.us_max = MAX(render_stats.us_max, us);
+	return err;
+}
+
+#ifdef CONFIG_DCLK_STRIP_BENCH
+/** @brief Time back to back full strip updates
+ *
+ * Every pixel is lit so the frame is the same size as any other, the
+ * SPI transfer does not depend on the colour.
+ */
+static void strip_benchmark(void)
+{
+	const uint8_t eights[STRIP_DIGITS] = {8, 8};
+	uint32_t start = k_cycle_get_32();
+
+	for (int i = 0; i < STRIP_BENCH_FRAMES; i++)
+	{
+		strip_draw(pixels[back], eights, state_colors[0]);
+		strip_push();
+	}
+
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+	render_stats.bench_us = us / STRIP_BENCH_FRAMES;
+	LOG_INF("Strip %d px: %d us per frame, %d frames/s", STRIP_NUM_PIXELS,
+			render_stats.bench_us, USEC_PER_SEC / MAX(render_stats.bench_us, 1));
+}
+#endif
+
+static void strip_render(void)
+{
+	uint32_t clock;
+	uint8_t look;
+	bool stale;
+	uint8_t drawn[STRIP_DIGITS] = {DIGIT_BLANK, DIGIT_BLANK};
+	uint8_t drawn_look = UINT8_MAX;
+
+	k_sem_take(&strip_ready, K_FOREVER);
+
+	while (1)
+	{
+		k_sem_take(&frame_sem, K_FOREVER);
+
+		uint32_t now = k_uptime_get_32();
+		k_spinlock_key_t key = k_spin_lock(&countdown_lock);
+		clock = countdown_shown(now);
+		look = countdown.holdover ? LOOK_HOLDOVER : MIN(countdown.state, LOOK_HOLDOVER - 1);
+		stale = countdown_stale(now);
+		k_spin_unlock(&countdown_lock, key);
+
+		// whole seconds rounded up, as on the controller
+		uint32_t seconds = MIN(DIV_ROUND_UP(clock, MSEC_PER_SEC), 99);
+		uint8_t digits[STRIP_DIGITS] = {
+			(seconds >= 10) ? (seconds / 10) : DIGIT_BLANK,
+			seconds % 10,
+		};
+
+		if (stale)
+		{
+			digits[0] = DIGIT_DASH;
+			digits[1] = DIGIT_DASH;
+		}
+
+		if (!memcmp(digits, drawn, sizeof(digits)) && (look == drawn_look))
+		{
+			continue;
+		}
+		memcpy(drawn, digits, sizeof(drawn));
+		drawn_look = look;
+
+		strip_draw(pixels[back], digits, state_colors[look]);
+		if (strip_push())
+		{
+			LOG_ERR("Failed to update LED strip");
+		}
+	}
+}
+
+K_THREAD_DEFINE(strip_render_id, RENDER_STACKSIZE, strip_render, NULL, NULL, NULL,
+				RENDER_PRIORITY, 0, 0);
+
+static void strip_start(void)
+{
+	if (strip_init())
 	{
-		LOG_ERR("LED strip device %s is not ready", strip->name);
 		return;
 	}
+
+#ifdef CONFIG_DCLK_STRIP_BENCH
+	// flashes the strip and holds back the first live frame
+	strip_encode_bench();
+	strip_benchmark();
+#endif
+	k_sem_give(&strip_ready);
 }
 
 int interface_init(struct interface_cb *app_cb)
 {
-	strip_init();
+	if (app_cb)
+	{
+		inter_cb = *app_cb;
+	}
+
+	strip_start();
+	boot_mark(BOOT_STRIP);
+
+	// first frame shows whatever was posted so far
+	k_sem_give(&frame_sem);
 
 	return 0;
 }
 
+/* First clock after a gap, call with countdown_lock held */
+static void countdown_reconcile(uint32_t now, int32_t error)
+{
+	uint32_t gap = now - countdown.lost_at;
+
+	countdown.holdover = false;
+
+	// the shown time may have run on past the controller's, but never by
+	// more than the gap. Anything else is a new shot and snaps.
+	if ((error > 0) && (error <= (int32_t)MIN(gap, COUNTDOWN_HOLDOVER_MS)) &&
+		(COUNTDOWN_RUNNING == countdown.state) && !countdown.new_epoch)
+	{
+		countdown.slew = error;
+		countdown.slew_step = COUNTDOWN_RECONCILE_SLEW_MS;
+	}
+
+	holdover_stats.count++;
+	holdover_stats.gap_last = gap;
+	holdover_stats.gap_max = MAX(holdover_stats.gap_max, gap);
+	holdover_stats.drift_last = error;
+	holdover_stats.drift_max = MAX(holdover_stats.drift_max, (uint32_t)abs(error));
+	if (gap >= COUNTDOWN_HOLDOVER_MS)
+	{
+		holdover_stats.expired++;
+	}
+}
+
 int interface_write_display(uint32_t clock)
 {
-	
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key = k_spin_lock(&countdown_lock);
+	bool reconciled = countdown.holdover;
+	bool slewed = false;
+	int32_t error = 0;
+
+	if (COUNTDOWN_RUNNING != countdown.state)
+	{
+		error = (int32_t)(clock - countdown.held);
+		countdown.held = clock;
+	}
+	else
+	{
+		// how far the shown clock is behind the controller's
+		error = (int32_t)(clock - countdown_shown(now));
+		countdown.deadline = now + clock;
+		// a new shot snaps, only the same shot is slewed
+		slewed = countdown.seeded && !countdown.new_epoch && (abs(error) < COUNTDOWN_SNAP_MS);
+		countdown.slew = slewed ? error : 0;
+		countdown.slew_step = COUNTDOWN_SLEW_MS;
+	}
+
+	if (reconciled)
+	{
+		countdown_reconcile(now, error);
+	}
+	countdown.seeded = true;
+	countdown.new_epoch = false;
+	countdown_align(now);
+	k_spin_unlock(&countdown_lock, key);
+
+	if (reconciled)
+	{
+		LOG_INF("Holdover %d ms, off by %d ms", holdover_stats.gap_last, error);
+	}
+	else if (error && (COUNTDOWN_RUNNING == countdown.state))
+	{
+		LOG_DBG("Countdown off by %d ms, %s", error, slewed ? "slewing" : "snapped");
+	}
+
+	k_sem_give(&frame_sem);
+	return 0;
+}
+
+int interface_write_epoch(uint16_t epoch)
+{
+	k_spinlock_key_t key = k_spin_lock(&countdown_lock);
+
+	if (countdown.seeded && (epoch != countdown.epoch))
+	{
+		countdown.new_epoch = true;
+	}
+	countdown.epoch = epoch;
+	k_spin_unlock(&countdown_lock, key);
+
+	return 0;
+}
+
+int interface_write_state(uint8_t state)
+{
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key = k_spin_lock(&countdown_lock);
+	uint32_t shown = countdown_shown(now);
+
+	// carry on from the time on the display until the next clock sample
+	countdown.state = state;
+	countdown.held = shown;
+	countdown.deadline = now + shown;
+	countdown.slew = 0;
+	countdown.slew_step = COUNTDOWN_SLEW_MS;
+	countdown_align(now);
+	k_spin_unlock(&countdown_lock, key);
+
+	k_sem_give(&frame_sem);
+	return 0;
+}
+
+int interface_link_lost(void)
+{
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key = k_spin_lock(&countdown_lock);
+
+	// a stopped clock cannot move without the controller, it stays as is
+	if (countdown.seeded && !countdown.holdover && (COUNTDOWN_RUNNING == countdown.state))
+	{
+		countdown.holdover = true;
+		countdown.lost_at = now;
+		countdown_align(now);
+	}
+	k_spin_unlock(&countdown_lock, key);
+
+	k_sem_give(&frame_sem);
+	return 0;
+}
+
+void interface_render_stats_get(struct interface_render_stats *stats)
+{
+	*stats = render_stats;
+}
+
+void interface_holdover_stats_get(struct interface_holdover_stats *stats)
+{
+	k_spinlock_key_t key = k_spin_lock(&countdown_lock);
 
+	*stats = holdover_stats;
+	k_spin_unlock(&countdown_lock, key);
 }
 
@@ -45,12 +45,13 @@ struct interface_cb {
  */
 int interface_init(struct interface_cb *app_cb);
 
-/** @brief Initialize the LBS Service.
+/** @brief Show a clock value on the LED digits
  *
- * This function registers application callback functions with the My LBS
- * Service
+ * Reseeds the local countdown, which keeps running between calls. A small
+ * difference to the shown time is slewed out, a large one snaps. Only
+ * wakes the render thread, safe to call from the Bluetooth callbacks.
  *
- * @param[in] clock value to display on clock
+ * @param[in] clock remaining time in ms, shown as whole seconds rounded up
  *
  *
  * @retval 0 If the operation was successful.
@@ -58,6 +59,80 @@ int interface_init(struct interface_cb *app_cb);
  */
 int interface_write_display(uint32_t clock);
 
+/** @brief Set the epoch of the next clock
+ *
+ * A clock from a new epoch is a new shot and always snaps, only one from
+ * the same epoch is slewed. Controllers without epochs never call this.
+ *
+ * @param[in] epoch epoch of the sync record carrying the next clock
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int interface_write_epoch(uint16_t epoch);
+
+/** @brief Set the shot clock state, which picks the digit colour
+ *
+ * The countdown carries on from the shown time until the next clock.
+ *
+ * @param[in] state 0 running, 1 stopped, 2 expired
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int interface_write_state(uint8_t state);
+
+/** @brief Keep counting without the controller
+ *
+ * A running clock carries on in the holdover colour and shows dashes if
+ * the link stays down too long. The next clock is reconciled against it.
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int interface_link_lost(void);
+
+/** @brief Strip update timing */
+struct interface_render_stats {
+	/** frames sent, benchmark included */
+	uint32_t frames;
+	/** time in strip_update() for the last and the worst frame */
+	uint32_t us_last;
+	uint32_t us_max;
+	/** average full strip frame time measured at init,
+	 *  0 without CONFIG_DCLK_STRIP_BENCH
+	 */
+	uint32_t bench_us;
+};
+
+/** @brief Copy the strip update timing
+ *
+ * @param[out] stats filled with the current statistics
+ */
+void interface_render_stats_get(struct interface_render_stats *stats);
+
+/** @brief How far holdover strayed from the controller */
+struct interface_holdover_stats {
+	/** holdovers ended by a clock from the controller */
+	uint32_t count;
+	/** of those, how many had run out and shown dashes */
+	uint32_t expired;
+	/** time without the controller (ms), last and longest */
+	uint32_t gap_last;
+	uint32_t gap_max;
+	/** controller minus shown time (ms) at the reconnect, last and the
+	 * largest magnitude
+	 */
+	int32_t drift_last;
+	uint32_t drift_max;
+};
+
+/** @brief Copy the holdover statistics
+ *
+ * @param[out] stats filled with the current statistics
+ */
+void interface_holdover_stats_get(struct interface_holdover_stats *stats);
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,329 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/pinctrl.h>
+#include <zephyr/dt-bindings/led/led.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/timing/timing.h>
+
+#include <nrfx_spim.h>
+
+#include "Strip.h"
+
+LOG_MODULE_DECLARE(Display_app, LOG_LEVEL_DBG);
+
+/* Same node the stock ws2812-spi driver used. The Zephyr SPI driver is
+ * disabled in prj.conf and the SPIM is driven through nrfx, so the next
+ * chunk can be started from its interrupt.
+ */
+#define STRIP_NODE DT_ALIAS(led_strip)
+#define STRIP_SPIM_NODE DT_BUS(STRIP_NODE)
+#define STRIP_SPIM_IDX 3
+
+BUILD_ASSERT(DT_SAME_NODE(STRIP_SPIM_NODE, DT_NODELABEL(spi3)),
+			 "STRIP_SPIM_IDX must name the bus of the led-strip node");
+BUILD_ASSERT(4000000 == DT_PROP(STRIP_NODE, spi_max_frequency),
+			 "the table is laid out for the 4 MHz nrfx default");
+
+/* WS2813B latches after 280 us of low */
+#define STRIP_LATCH_US 280
+#define STRIP_RESET_US 300
+
+/* Bytes on the wire per pixel, 3 colours of 4 SPI bytes */
+#define WS_PX_WORDS 3
+#define WS_PX_BYTES (WS_PX_WORDS * sizeof(uint32_t))
+
+#define STRIP_BENCH_ROUNDS 10
+
+BUILD_ASSERT(IS_ENABLED(CONFIG_LITTLE_ENDIAN), "table words are laid out for a little endian CPU");
+
+PINCTRL_DT_DEFINE(STRIP_SPIM_NODE);
+
+static const nrfx_spim_t ws_spim = NRFX_SPIM_INSTANCE(STRIP_SPIM_IDX);
+
+/*
+
+
+
+*/
+/*LOOKUP TABLE*/
+/* At 4 MHz a 0 is 1000 (250 ns high) and a 1 is 1110 (750 ns high), both
+ * inside the WS2813B limits. Each SPI byte carries two LED bits and the
+ * first byte on the wire is the lowest byte of the word.
+ */
+#define WS_NIBBLE(bit) ((bit) ? 0xE : 0x8)
+#define WS_SPI_BYTE(v, k) ((WS_NIBBLE((v) & BIT(7 - 2 * (k))) << 4) | WS_NIBBLE((v) & BIT(6 - 2 * (k))))
+#define WS_PATTERN(v, ...)                                                                        \
+	((uint32_t)WS_SPI_BYTE(v, 0) | ((uint32_t)WS_SPI_BYTE(v, 1) << 8) |                           \
+	 ((uint32_t)WS_SPI_BYTE(v, 2) << 16) | ((uint32_t)WS_SPI_BYTE(v, 3) << 24))
+
+static const uint32_t ws_lut[256] = {LISTIFY(256, WS_PATTERN, (, ))};
+
+/* Wire order of the colours, from the devicetree color-mapping */
+#define WS_COLOR(px, i)                                                                           \
+	((LED_COLOR_ID_RED == DT_PROP_BY_IDX(STRIP_NODE, color_mapping, i))     ? (px)->r           \
+	 : (LED_COLOR_ID_GREEN == DT_PROP_BY_IDX(STRIP_NODE, color_mapping, i)) ? (px)->g           \
+																			: (px)->b)
+
+static void ws_encode(uint32_t *dst, const struct led_rgb *px, size_t count)
+{
+	for (size_t i = 0; i < count; i++, px++)
+	{
+		*dst++ = ws_lut[WS_COLOR(px, 0)];
+		*dst++ = ws_lut[WS_COLOR(px, 1)];
+		*dst++ = ws_lut[WS_COLOR(px, 2)];
+	}
+}
+
+/*
+
+
+
+*/
+/*STREAMING*/
+static uint32_t cycles_to_ns(timing_t start, timing_t end)
+{
+	return (uint32_t)timing_cycles_to_ns(timing_cycles_get(&start, &end));
+}
+
+/* EasyDMA reads one half while the other one is encoded. A frame that
+ * fits both halves goes out as a single transfer.
+ */
+#define WS_HALF_WORDS (STRIP_CHUNK_PX * WS_PX_WORDS)
+#define WS_HALF(h) (&ws_buf[(h) * WS_HALF_WORDS])
+static uint32_t ws_buf[2 * WS_HALF_WORDS];
+
+/* Frame on the wire, owned by the SPIM interrupt until ws_done is given */
+static struct
+{
+	const struct led_rgb *pixels;
+	size_t count;
+	size_t encoded;
+	size_t sent;
+	size_t next; // pixels waiting in the idle half
+	uint8_t half; // half on the wire
+	uint32_t encode_ns;
+	uint32_t gap_cycles;
+	int err;
+} ws_frame;
+
+K_SEM_DEFINE(ws_done, 0, 1);
+
+static struct strip_stats stats;
+
+/* Fill the half that is not on the wire with the next chunk */
+static void ws_encode_next(void)
+{
+	size_t n = MIN(ws_frame.count - ws_frame.encoded, STRIP_CHUNK_PX);
+	timing_t t = timing_counter_get();
+
+	ws_encode(WS_HALF(ws_frame.half ^ 1), &ws_frame.pixels[ws_frame.encoded], n);
+	ws_frame.encode_ns += cycles_to_ns(t, timing_counter_get());
+	ws_frame.encoded += n;
+	ws_frame.next = n;
+}
+
+static nrfx_err_t ws_send(const uint32_t *buf, size_t count)
+{
+	nrfx_spim_xfer_desc_t xfer = NRFX_SPIM_XFER_TX(buf, count * WS_PX_BYTES);
+
+	return nrfx_spim_xfer(&ws_spim, &xfer, 0);
+}
+
+/* The next chunk is already encoded, so it is started first and the
+ * freed half is refilled while it is on the wire.
+ */
+static void ws_spim_handler(nrfx_spim_evt_t const *event, void *context)
+{
+	uint32_t end = k_cycle_get_32();
+
+	if (!ws_frame.next)
+	{
+		k_sem_give(&ws_done);
+		return;
+	}
+
+	ws_frame.half ^= 1;
+	nrfx_err_t err = ws_send(WS_HALF(ws_frame.half), ws_frame.next);
+
+	ws_frame.gap_cycles = MAX(ws_frame.gap_cycles, k_cycle_get_32() - end);
+	if (NRFX_SUCCESS != err)
+	{
+		ws_frame.err = -EIO;
+		k_sem_give(&ws_done);
+		return;
+	}
+
+	ws_frame.sent += ws_frame.next;
+	ws_encode_next();
+}
+
+int strip_init(void)
+{
+	nrfx_spim_config_t config = NRFX_SPIM_DEFAULT_CONFIG(
+		NRF_SPIM_PIN_NOT_CONNECTED, NRF_SPIM_PIN_NOT_CONNECTED, NRF_SPIM_PIN_NOT_CONNECTED,
+		NRF_SPIM_PIN_NOT_CONNECTED);
+
+	// the pins come from the bus pinctrl in the devicetree
+	config.skip_gpio_cfg = true;
+	config.skip_psel_cfg = true;
+
+	int err = pinctrl_apply_state(PINCTRL_DT_DEV_CONFIG_GET(STRIP_SPIM_NODE),
+								  PINCTRL_STATE_DEFAULT);
+	if (err)
+	{
+		LOG_ERR("LED strip pins not set (err %d)", err);
+		return err;
+	}
+
+	IRQ_CONNECT(DT_IRQN(STRIP_SPIM_NODE), DT_IRQ(STRIP_SPIM_NODE, priority), nrfx_isr,
+				NRFX_CONCAT_3(nrfx_spim_, STRIP_SPIM_IDX, _irq_handler), 0);
+
+	if (NRFX_SUCCESS != nrfx_spim_init(&ws_spim, &config, ws_spim_handler, NULL))
+	{
+		LOG_ERR("LED strip SPIM init failed");
+		return -ENODEV;
+	}
+
+	// the system timer is 32 kHz, encode times need the CPU cycle counter
+	timing_init();
+	timing_start();
+	return 0;
+}
+
+/** @brief Ping-pong between the two buffers
+ *
+ * The SPIM interrupt starts the chunk waiting in the idle buffer and
+ * then encodes the one after it, so the gap between transfers is the
+ * interrupt latency rather than a thread wakeup. The data line idles low
+ * in the gap, which the LEDs take as a long low bit, so the worst gap is
+ * still kept in the stats. Chains that fit both buffers have no gap at
+ * all.
+ */
+int strip_update(const struct led_rgb *pixels, size_t count)
+{
+	uint32_t start = k_cycle_get_32();
+	size_t first = (count <= 2 * STRIP_CHUNK_PX) ? count : STRIP_CHUNK_PX;
+	timing_t t = timing_counter_get();
+	int err = 0;
+
+	ws_frame.pixels = pixels;
+	ws_frame.count = count;
+	ws_frame.encoded = first;
+	ws_frame.sent = 0;
+	ws_frame.half = 0;
+	ws_frame.gap_cycles = 0;
+	ws_frame.err = 0;
+
+	ws_encode(WS_HALF(0), pixels, first);
+	ws_frame.encode_ns = cycles_to_ns(t, timing_counter_get());
+	ws_encode_next();
+
+	if (first)
+	{
+		ws_frame.sent = first;
+		if (NRFX_SUCCESS != ws_send(WS_HALF(0), first))
+		{
+			ws_frame.sent = 0;
+			err = -EIO;
+		}
+		else
+		{
+			k_sem_take(&ws_done, K_FOREVER);
+			err = ws_frame.err;
+		}
+	}
+
+	k_busy_wait(STRIP_RESET_US);
+
+	uint32_t gap_us = k_cyc_to_us_floor32(ws_frame.gap_cycles);
+
+	stats.encode_us = ws_frame.encode_ns / NSEC_PER_USEC;
+	stats.frame_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	stats.pixels = ws_frame.sent;
+	stats.gap_us = gap_us;
+	stats.gap_max_us = MAX(stats.gap_max_us, gap_us);
+	if (gap_us >= STRIP_LATCH_US)
+	{
+		stats.torn++;
+		LOG_WRN("Strip gap %d us, frame latched early", gap_us);
+	}
+	return err;
+}
+
+void strip_stats_get(struct strip_stats *out)
+{
+	*out = stats;
+}
+
+/*
+
+
+
+*/
+/*BENCHMARK*/
+#ifdef CONFIG_DCLK_STRIP_BENCH
+/* One chunk in the stock layout, one SPI byte per LED bit */
+static uint8_t stock_buf[STRIP_CHUNK_PX * 3 * 8];
+
+/* volatile so the compiler keeps the stores to a buffer nobody reads */
+static void stock_encode(volatile uint8_t *dst, const struct led_rgb *px, size_t count)
+{
+	const uint8_t one = DT_PROP(STRIP_NODE, spi_one_frame);
+	const uint8_t zero = DT_PROP(STRIP_NODE, spi_zero_frame);
+
+	for (size_t i = 0; i < count; i++, px++)
+	{
+		const uint8_t color[3] = {WS_COLOR(px, 0), WS_COLOR(px, 1), WS_COLOR(px, 2)};
+
+		for (int c = 0; c < 3; c++)
+		{
+			for (int bit = 7; bit >= 0; bit--)
+			{
+				*dst++ = (color[c] & BIT(bit)) ? one : zero;
+			}
+		}
+	}
+}
+
+void strip_encode_bench(void)
+{
+	static const uint16_t chains[] = {16, 150, 600};
+	struct led_rgb src[STRIP_CHUNK_PX];
+
+	for (int i = 0; i < STRIP_CHUNK_PX; i++)
+	{
+		src[i] = (struct led_rgb){.r = i * 16, .g = 0xa5, .b = 255 - i};
+	}
+
+	for (size_t c = 0; c < ARRAY_SIZE(chains); c++)
+	{
+		uint32_t len = chains[c];
+		timing_t start = timing_counter_get();
+
+		for (int round = 0; round < STRIP_BENCH_ROUNDS; round++)
+		{
+			for (uint32_t done = 0; done < len; done += STRIP_CHUNK_PX)
+			{
+				ws_encode(WS_HALF(0), src, MIN(len - done, STRIP_CHUNK_PX));
+			}
+		}
+		uint32_t ns = cycles_to_ns(start, timing_counter_get()) / STRIP_BENCH_ROUNDS;
+
+		LOG_INF("%4d px  table: %d ns/px, %d B SPI RAM", len, ns / len, (int)sizeof(ws_buf));
+
+		start = timing_counter_get();
+		for (int round = 0; round < STRIP_BENCH_ROUNDS; round++)
+		{
+			for (uint32_t done = 0; done < len; done += STRIP_CHUNK_PX)
+			{
+				stock_encode(stock_buf, src, MIN(len - done, STRIP_CHUNK_PX));
+			}
+		}
+		ns = cycles_to_ns(start, timing_counter_get()) / STRIP_BENCH_ROUNDS;
+
+		// the stock driver holds the whole chain expanded
+		LOG_INF("%4d px  stock: %d ns/px, %d B SPI RAM", len, ns / len, len * 3 * 8);
+	}
+}
+#endif
@@ -0,0 +1,84 @@
+#ifndef DCLK_STRIP
+#define DCLK_STRIP
+
+/**
+ * @file Strip.h
+ * @defgroup DCLK_refDisplay
+ * @{
+ * @brief WS2812/WS2813 driver streaming from a lookup table over SPI
+ *
+ * Every LED bit is sent as 4 SPI bits at 4 MHz, so one colour byte is one
+ * 32 bit word from a 256 entry table. The chain goes out in chunks
+ * through two small DMA buffers: the SPIM interrupt starts one and
+ * encodes the next chunk into the other, so the SPI RAM does not grow
+ * with the chain length and the gaps do not wait on the scheduler. A
+ * chain that fits both buffers goes out in one transfer.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <zephyr/types.h>
+#include <zephyr/drivers/led_strip.h>
+
+/** Pixels per DMA buffer */
+#define STRIP_CHUNK_PX 16
+
+/** @brief Cost of the last update */
+struct strip_stats {
+	/** time spent encoding, for the whole chain */
+	uint32_t encode_us;
+	/** from the first transfer to the end of the latch */
+	uint32_t frame_us;
+	/** pixels sent */
+	uint32_t pixels;
+	/** longest time from the end of a chunk to the start of the next,
+	 *  from the SPIM interrupt, this update and since boot
+	 */
+	uint32_t gap_us;
+	uint32_t gap_max_us;
+	/** updates with a gap past the latch time, shown torn */
+	uint32_t torn;
+};
+
+/** @brief Set up the SPIM and its pins
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int strip_init(void);
+
+/** @brief Send a frame, returns once it is latched
+ *
+ * @param[in] pixels colours in chain order, not modified
+ * @param[in] count number of pixels, any length
+ *
+ * @retval 0 If the operation was successful.
+ *           Otherwise, a (negative) error code is returned.
+ */
+int strip_update(const struct led_rgb *pixels, size_t count);
+
+/** @brief Copy the timing of the last update
+ *
+ * @param[out] stats filled with the last update
+ */
+void strip_stats_get(struct strip_stats *stats);
+
+/** @brief Log encode time per pixel and SPI RAM against the stock driver
+ *
+ * Encodes chains of 16, 150 and 600 pixels without sending them, with
+ * the table and with the stock driver's one byte per bit expansion.
+ * Only built with CONFIG_DCLK_STRIP_BENCH.
+ */
+void strip_encode_bench(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @}
+ */
+
+#endif /* DCLK_STRIP */
@@ -13,6 +13,7 @@
 #include "DCLK_client.h"
 
 #include "Interface_display.h"
+#include "Boot.h"
 
 LOG_MODULE_REGISTER(Display_app, CONFIG_LOG_DEFAULT_LEVEL);
 
@@ -20,15 +21,28 @@ LOG_MODULE_REGISTER(Display_app, CONFIG_LOG_DEFAULT_LEVEL);
 
 static uint8_t app_clock_cb(uint32_t data)
 {
-	LOG_INF("DCLK - Clock = %d ms", data);
+	LOG_DBG("DCLK - Clock = %d ms", data);
+	interface_write_display(data);
 	return BT_GATT_ITER_CONTINUE;
 }
 static uint8_t app_state_cb(uint8_t data)
 {
 	LOG_INF("DCLK - State = %d", data);
+	interface_write_state(data);
 	return BT_GATT_ITER_CONTINUE;
 }
 
+static void app_epoch_cb(uint16_t epoch)
+{
+	interface_write_epoch(epoch);
+}
+
+static void app_link_lost_cb(void)
+{
+	LOG_INF("DCLK - Link lost");
+	interface_link_lost();
+}
+
 static void unsubscribed(struct bt_gatt_subscribe_params *params)
 {
 	LOG_INF("unsub cb");
@@ -38,6 +52,8 @@ static void unsubscribed(struct bt_gatt_subscribe_params *params)
 static struct dclk_client_cb app_callbacks = {
 	.received_clock = app_clock_cb,
 	.received_state = app_state_cb,
+	.received_epoch = app_epoch_cb,
+	.link_lost = app_link_lost_cb,
 	.unsubscribed = unsubscribed,
 };
 
@@ -57,19 +73,22 @@ static struct interface_cb inter_callbacks = {
 
 int main(void)
 {
+	boot_mark(BOOT_MAIN);
 	LOG_INF("DCLK_Display initialized\n");
 
-	int err = interface_init(&inter_callbacks);
+	// bt_enable returns straight away, the strip comes up while the
+	// controller and settings are loading
+	int err = dclk_client_init(&app_callbacks, 123456);
 	if (err)
 	{
-		printk("Interface init failed (err %d)\n", err);
+		printk("Failed to init LBS (err:%d)\n", err);
 		return;
 	}
 
-	err = dclk_client_init(&app_callbacks, 123456);
+	err = interface_init(&inter_callbacks);
 	if (err)
 	{
-		printk("Failed to init LBS (err:%d)\n", err);
+		printk("Interface init failed (err %d)\n", err);
 		return;
 	}
 	LOG_INF("Bluetooth initialized\n");